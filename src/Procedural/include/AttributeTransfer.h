@@ -0,0 +1,99 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#ifndef ATTRIBUTETRANSFER_H
+#define ATTRIBUTETRANSFER_H
+
+#include <vector>
+
+#include <GA/GA_Types.h>
+#include <GU/GU_Detail.h>
+
+#include <FnAttribute/FnAttribute.h>
+
+namespace FnKat = Foundry::Katana;
+
+namespace ds_mfk {
+
+// Elements of a detail a Katana location was converted into, used to map
+// the Katana attribute scopes onto the Houdini attribute owners.
+struct AttributeTarget
+{
+    AttributeTarget()
+        : startPointOffset(GA_INVALID_OFFSET), numPoints(0),
+          startPrimitiveOffset(GA_INVALID_OFFSET), numFaces(0),
+          startVertexOffset(GA_INVALID_OFFSET), numVertices(0) {}
+
+    // 'point' scope. When only part of the points were built,
+    // 'sourcePoints' holds the Katana point of each of them.
+    GA_Offset startPointOffset;
+    GA_Size numPoints;
+    std::vector<GA_Size> sourcePoints;
+
+    // 'face' scope. Faces with no vertices have no primitive, in which case
+    // 'primitiveFaces' holds the Katana face of each primitive.
+    GA_Offset startPrimitiveOffset;
+    GA_Size numFaces;
+    std::vector<GA_Size> primitiveFaces;
+
+    // 'vertex' scope, with 'sourceVertices' as 'sourcePoints'
+    GA_Offset startVertexOffset;
+    GA_Size numVertices;
+    std::vector<GA_Size> sourceVertices;
+
+    // Element maps are in increasing order.
+};
+
+// Copies the normals, texture coordinates and arbitrary attributes of the
+// Katana 'geometry' group onto the elements described by 'target'. Scopes
+// with no elements in the target are ignored, 'primitive' scoped attributes
+// become detail attributes. With 'varyingOnly', attributes with a single
+// time sample are skipped.
+void transferAttributes(GU_Detail* gdp,
+                        const FnKat::GroupAttribute& geometryAttr,
+                        const AttributeTarget& target,
+                        float sampleTime = 0.0f, bool varyingOnly = false);
+
+} // namespace ds_mfk
+
+#endif // ATTRIBUTETRANSFER_H
@@ -0,0 +1,90 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#ifndef BOUNDCACHE_H
+#define BOUNDCACHE_H
+
+#include <string>
+
+#include <UT/UT_BoundingBox.h>
+
+#include "ShardedMap.h"
+
+namespace ds_mfk {
+
+// Thread safe map between location paths and the world space bounds computed
+// for them, so that each subtree is only measured once, whether by the
+// procedural expanding it or by the one expanding its parent.
+class BoundCache
+{
+public:
+    // 'valid' tells if the bound could be computed at all
+    struct Entry
+    {
+        UT_BoundingBox bbox;
+        bool valid;
+    };
+
+    BoundCache() {}
+    ~BoundCache() {}
+
+    // Returns the bound stored for 'path', or null.
+    const Entry* find(const std::string& path) const;
+
+    // Stores a bound for 'path', unless already stored by another thread.
+    // Returns the bound held by the cache.
+    const Entry& insert(const std::string& path, const UT_BoundingBox& bbox,
+                        bool valid);
+
+    void clear();
+
+private:
+    BoundCache(const BoundCache&);
+    BoundCache& operator=(const BoundCache&);
+
+    ShardedMap<Entry> _bounds;
+};
+
+} // namespace ds_mfk
+
+#endif // BOUNDCACHE_H
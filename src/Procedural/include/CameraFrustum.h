@@ -0,0 +1,103 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#ifndef CAMERAFRUSTUM_H
+#define CAMERAFRUSTUM_H
+
+#include <vector>
+
+#include <UT/UT_BoundingBox.h>
+#include <UT/UT_Matrix4.h>
+
+#include "ProceduralSettings.h"
+
+namespace ds_mfk {
+
+// View volume of the render camera, enlarged by the culling margin so that
+// objects just outside the frame still cast shadows and show up in
+// reflections. With a moving camera, one transform is kept per sample and
+// boxes are tested against the volume swept over the shutter.
+class CameraFrustum
+{
+public:
+    CameraFrustum(const ProceduralSettings& settings);
+    ~CameraFrustum() {}
+
+    bool hasCamera() const { return !_worldToCamera.empty(); }
+    bool isEnabled() const { return _culling && hasCamera(); }
+
+    // True if 'bbox', in world space, stays outside the volume during the
+    // whole shutter.
+    bool isOutside(const UT_BoundingBox& bbox) const;
+
+    // Area in pixels of the screen rectangle enclosing 'bbox' at shutter
+    // open. Unbounded if the box crosses the near plane.
+    double getScreenArea(const UT_BoundingBox& bbox) const;
+
+private:
+    // Signed distance of a camera space point beyond a plane of the volume
+    double getPlaneDistance(int plane, const UT_Vector3D& point) const;
+
+    std::vector<UT_Matrix4D> _worldToCamera;
+
+    // Half extents of the image plane at unit distance, enlarged to contain
+    // the view whichever side the field of view spans. Used for culling.
+    double _tanX;
+    double _tanY;
+
+    // Exact half extents of the image plane rendered by Mantra, used to
+    // measure screen areas.
+    double _screenTanX;
+    double _screenTanY;
+
+    double _near;
+    double _far;
+    double _margin;
+    bool _culling;
+
+    int _resolution[2];
+};
+
+} // namespace ds_mfk
+
+#endif // CAMERAFRUSTUM_H
@@ -0,0 +1,89 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#ifndef DISKGEOMETRYCACHE_H
+#define DISKGEOMETRYCACHE_H
+
+#include <string>
+
+#include <GU/GU_Detail.h>
+
+namespace ds_mfk {
+
+// Converted geometry stored as compressed .bgeo.sc files, named after a
+// digest of the geometry key, so that later renders and other hosts can load
+// it instead of translating it again. The full key is stored in the file.
+class DiskGeometryCache
+{
+public:
+    // An empty 'directory' disables the cache.
+    DiskGeometryCache(const std::string& directory);
+    ~DiskGeometryCache() {}
+
+    bool isEnabled() const { return !_directory.empty(); }
+
+    // Returns the file holding the geometry stored for 'key'.
+    std::string getPath(const std::string& key) const;
+
+    // Returns true if geometry was stored for 'key'.
+    bool contains(const std::string& key) const;
+
+    // Loads the geometry stored for 'key' into 'gdp'. Fails if the file was
+    // stored for another key with the same digest.
+    bool load(const std::string& key, GU_Detail* gdp) const;
+
+    // Stores 'gdp' for 'key', which is added to it as the 'cachekey' detail
+    // attribute. The file is written under a temporary name and then
+    // renamed, so concurrent readers never see a partial file.
+    bool save(const std::string& key, GU_Detail& gdp) const;
+
+private:
+    DiskGeometryCache(const DiskGeometryCache&);
+    DiskGeometryCache& operator=(const DiskGeometryCache&);
+
+    const std::string _directory;
+};
+
+} // namespace ds_mfk
+
+#endif // DISKGEOMETRYCACHE_H
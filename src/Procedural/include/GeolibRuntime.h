@@ -0,0 +1,125 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#ifndef GEOLIBRUNTIME_H
+#define GEOLIBRUNTIME_H
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <UT/UT_Lock.h>
+
+#include <FnAttribute/FnAttribute.h>
+#include <FnGeolib/runtime/FnGeolibRuntime.h>
+#include <FnScenegraphIterator/FnScenegraphIterator.h>
+
+namespace FnKat = Foundry::Katana;
+
+namespace ds_mfk {
+
+// Process wide Geolib state, shared by all the main procedurals of a Mantra
+// session: Geolib is bootstrapped once, and each render script is only
+// parsed again when the file changes on disk.
+//
+// Geolib clients, and the iterators created from them, are not thread safe.
+// The thread reading a script keeps the client built by readScript(). Other
+// threads get their own client, created the first time they ask for it, on a
+// single runtime shared by all of them. Iterators must not be used by other
+// threads than the one owning their client.
+class GeolibRuntime
+{
+public:
+    static GeolibRuntime& getInstance();
+
+    // Bootstraps Geolib from the Katana installation at 'katanaRoot', unless
+    // it was already done. Returns false on failure.
+    bool bootstrap(const std::string& katanaRoot);
+
+    // Returns the root iterator of the render script at 'scriptPath' for the
+    // calling thread, or an invalid iterator if the script cannot be read.
+    FnKat::FnScenegraphIterator getRootIterator(const std::string& scriptPath);
+
+    // Returns the location at 'locationPath' of the last version read of the
+    // script at 'scriptPath', through the client of the calling thread.
+    FnKat::FnScenegraphIterator getThreadIterator(
+        const std::string& scriptPath, const std::string& locationPath);
+
+private:
+    GeolibRuntime() : _bootstrapped(false) {}
+    GeolibRuntime(const GeolibRuntime&);
+    GeolibRuntime& operator=(const GeolibRuntime&);
+
+    // Client of a thread, and its root iterator
+    struct ThreadClient
+    {
+        FnKat::GeolibRuntime::Client client;
+        FnKat::FnScenegraphIterator rootIterator;
+    };
+
+    // Identifies a version of a script file. 'opTree' is the scene built by
+    // the script, the other threads cook it on 'runtime'.
+    struct Script
+    {
+        int64_t mtimeSec;
+        int64_t mtimeNsec;
+        int64_t size;
+        FnKat::FnScenegraphIterator rootIterator;
+        std::thread::id rootThread;
+        FnAttribute::GroupAttribute opTree;
+        FnKat::GeolibRuntime::Ptr runtime;
+        FnKat::GeolibRuntime::Op op;
+        std::unordered_map<std::thread::id, ThreadClient> threadClients;
+    };
+
+    FnKat::FnScenegraphIterator getThreadRoot(Script& script);
+
+    UT_Lock _lock;
+    bool _bootstrapped;
+    std::unordered_map<std::string, Script> _scripts;
+};
+
+} // namespace ds_mfk
+
+#endif // GEOLIBRUNTIME_H
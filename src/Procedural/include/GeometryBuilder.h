@@ -0,0 +1,155 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#ifndef GEOMETRYBUILDER_H
+#define GEOMETRYBUILDER_H
+
+#include <vector>
+
+#include <GA/GA_Types.h>
+#include <GU/GU_Detail.h>
+#include <GU/GU_DetailHandle.h>
+#include <UT/UT_BoundingBox.h>
+#include <UT/UT_Matrix4.h>
+
+#include <FnAttribute/FnAttribute.h>
+
+namespace FnKat = Foundry::Katana;
+
+namespace ds_mfk {
+
+// Helpers converting Katana geometry attributes into Houdini geometry.
+// Attribute values are transferred in blocks, straight from the Katana
+// attribute data, to avoid per-element calls into the GA layer.
+
+// Appends one point for each tuple of 'positions' as a single block and sets
+// their positions. Returns the offset of the first appended point.
+GA_Offset appendPointBlock(GU_Detail* gdp,
+                           const FnKat::FloatConstVector& positions);
+
+// Overwrites the positions of the points in the block starting at 'startOff'
+// with the tuples in 'positions'.
+void setPointBlockPositions(GU_Detail* gdp, GA_Offset startOff,
+                            const FnKat::FloatConstVector& positions);
+
+// Overwrites the values of the vector point attribute 'attrib' for the block
+// of points starting at 'startOff' with the tuples in 'values'.
+void setPointBlockVectors(GU_Detail* gdp, GA_Attribute* attrib,
+                          GA_Offset startOff,
+                          const FnKat::FloatConstVector& values);
+
+// Enlarges 'bbox' to enclose the tuples of 'positions'.
+void enlargePointBounds(UT_BoundingBox& bbox,
+                        const FnKat::FloatConstVector& positions);
+
+// Overwrites the values of the float point attribute 'attrib' for the block
+// of points starting at 'startOff' with 'values'.
+void setPointBlockFloats(GU_Detail* gdp, GA_Attribute* attrib,
+                         GA_Offset startOff,
+                         const FnKat::FloatConstVector& values);
+
+// Builds the polygons described by the Katana 'startIndex' and 'vertexList'
+// arrays as a single block, wiring their vertices to the 'numPoints' points
+// starting at 'startPtOff'. Faces with no vertices are skipped. Returns the
+// offset of the first polygon, or GA_INVALID_OFFSET if the topology is not
+// valid.
+GA_Offset buildPolygonBlock(GU_Detail* gdp, GA_Offset startPtOff,
+                            GA_Size numPoints,
+                            const FnKat::IntConstVector& startIndex,
+                            const FnKat::IntConstVector& vertexList,
+                            bool closed = true);
+
+// Builds one open polygon for each entry of the Katana 'numVertices' array
+// as a single block, consuming the 'numPoints' points starting at
+// 'startPtOff' in order. Mantra renders open polygons as curves. Returns the
+// offset of the first curve, or GA_INVALID_OFFSET if the counts do not match
+// the points.
+GA_Offset buildCurveBlock(GU_Detail* gdp, GA_Offset startPtOff,
+                          GA_Size numPoints,
+                          const FnKat::IntConstVector& numVertices);
+
+// Builds one open spline curve of order 'degree' + 1 for each entry of the
+// Katana 'numVertices' array as a single block, consuming the 'numPoints'
+// points starting at 'startPtOff' in order. Bezier curves need
+// 'degree' * n + 1 vertices, other curves are uniform B-splines of at least
+// 'degree' + 1 vertices. Returns the offset of the first curve, or
+// GA_INVALID_OFFSET if the counts do not fit the basis or the points.
+GA_Offset buildSplineCurves(GU_Detail* gdp, GA_Offset startPtOff,
+                            GA_Size numPoints,
+                            const FnKat::IntConstVector& numVertices,
+                            int degree, bool bezier);
+
+// Sets the "creaseweight" vertex attribute of the polygons built by
+// buildPolygonBlock() from the Katana subdivision crease arrays. Each crease
+// is a chain of 'creaseLengths' points of 'creaseIndex', with either one
+// sharpness for the whole chain or one for each of its edges.
+void setCreaseWeights(GU_Detail* gdp, GA_Offset startPrimOff,
+                      const FnKat::IntConstVector& startIndex,
+                      const FnKat::IntConstVector& vertexList,
+                      const FnKat::IntConstVector& creaseIndex,
+                      const FnKat::IntConstVector& creaseLengths,
+                      const FnKat::FloatConstVector& creaseSharpness);
+
+// Sets the "cornerweight" point attribute of the 'numPoints' points starting
+// at 'startPtOff' from the Katana subdivision corner arrays.
+void setCornerWeights(GU_Detail* gdp, GA_Offset startPtOff, GA_Size numPoints,
+                      const FnKat::IntConstVector& cornerIndex,
+                      const FnKat::FloatConstVector& cornerSharpness);
+
+// Appends a packed primitive referencing 'gdh' for each of the 'instances',
+// where each index selects a row-major 4x4 matrix of the flat 'matrices'
+// array. Instance matrices are applied after 'xform'.
+void appendPackedInstances(GU_Detail* gdp, const GU_ConstDetailHandle& gdh,
+                           const UT_Matrix4D& xform, const double* matrices,
+                           const std::vector<int64_t>& instances);
+
+// Fills 'matrices' with a row-major 4x4 matrix for each instance of the
+// Katana instance array 'geometryAttr', read from 'instanceMatrix' or built
+// from 'instanceScale', 'instanceRotateX/Y/Z' and 'instanceTranslate'.
+// Returns false if neither describes the instances consistently.
+bool getInstanceMatrices(const FnKat::GroupAttribute& geometryAttr,
+                         std::vector<double>& matrices);
+
+} // namespace ds_mfk
+
+#endif // GEOMETRYBUILDER_H
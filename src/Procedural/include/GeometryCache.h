@@ -0,0 +1,84 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#ifndef GEOMETRYCACHE_H
+#define GEOMETRYCACHE_H
+
+#include <string>
+#include <unordered_map>
+
+#include <GU/GU_DetailHandle.h>
+#include <UT/UT_Lock.h>
+
+namespace ds_mfk {
+
+// Thread safe map between the hash of Katana geometry attributes and the
+// Houdini geometry converted from them, so that identical meshes are only
+// converted once and then shared by all the locations using them.
+class GeometryCache
+{
+public:
+    GeometryCache() {}
+    ~GeometryCache() {}
+
+    // Returns the geometry stored for 'key', or an invalid handle.
+    GU_ConstDetailHandle find(const std::string& key) const;
+
+    // Stores 'gdh' for 'key', unless another thread already stored geometry
+    // for the same key. Returns the geometry held by the cache.
+    GU_ConstDetailHandle insert(const std::string& key,
+                                const GU_ConstDetailHandle& gdh);
+
+    void clear();
+
+private:
+    GeometryCache(const GeometryCache&);
+    GeometryCache& operator=(const GeometryCache&);
+
+    mutable UT_Lock _lock;
+    std::unordered_map<std::string, GU_ConstDetailHandle> _details;
+};
+
+} // namespace ds_mfk
+
+#endif // GEOMETRYCACHE_H
@@ -0,0 +1,109 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#ifndef INSTANCESOURCECACHE_H
+#define INSTANCESOURCECACHE_H
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <GU/GU_DetailHandle.h>
+#include <UT/UT_Lock.h>
+#include <UT/UT_Matrix4.h>
+
+#include <FnScenegraphIterator/FnScenegraphIterator.h>
+
+namespace FnKat = Foundry::Katana;
+
+namespace ds_mfk {
+
+// Mesh found below an 'instance source' location, with its transform relative
+// to the instance source itself.
+struct InstanceSourceElement
+{
+    // Owned by the thread that translated the instance source
+    FnKat::FnScenegraphIterator iterator;
+    std::string path;
+    std::thread::id thread;
+    GU_ConstDetailHandle gdh;
+    UT_Matrix4D xform;
+
+    // Subdivision cages are never packed, each instance gets its own copy
+    bool subdivision;
+};
+
+typedef std::vector<InstanceSourceElement> InstanceSource;
+typedef std::shared_ptr<const InstanceSource> InstanceSourcePtr;
+
+// Thread safe map between the path of 'instance source' locations and their
+// translated content, shared by all the instances referencing them.
+class InstanceSourceCache
+{
+public:
+    InstanceSourceCache() {}
+    ~InstanceSourceCache() {}
+
+    // Returns the instance source translated for 'path', or null.
+    InstanceSourcePtr find(const std::string& path) const;
+
+    // Stores 'source' for 'path', unless another thread already stored it.
+    // Returns the instance source held by the cache.
+    InstanceSourcePtr insert(const std::string& path,
+                             const InstanceSourcePtr& source);
+
+    void clear();
+
+private:
+    InstanceSourceCache(const InstanceSourceCache&);
+    InstanceSourceCache& operator=(const InstanceSourceCache&);
+
+    mutable UT_Lock _lock;
+    std::unordered_map<std::string, InstanceSourcePtr> _sources;
+};
+
+} // namespace ds_mfk
+
+#endif // INSTANCESOURCECACHE_H
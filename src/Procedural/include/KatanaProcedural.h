@@ -44,11 +44,16 @@
 #ifndef KATANAPROCEDURAL_H
 #define KATANAPROCEDURAL_H
 
+#include <string>
+#include <thread>
+
 #include <UT/UT_BoundingBox.h>
 #include <VRAY/VRAY_Procedural.h>
 
 #include <FnScenegraphIterator/FnScenegraphIterator.h>
 
+#include "ProceduralContext.h"
+
 namespace ds_mfk {
 
 // Main procedural responsible to parse a Katana render script and generate a
@@ -66,9 +71,14 @@ public:
     void render() override;
 
 private:
+    // Root iterator usable by the calling thread
+    FnKat::FnScenegraphIterator getRootIterator() const;
+
     UT_BoundingBox _bbox;
     std::string _producerFilepath;
     FnKat::FnScenegraphIterator _rootIterator;
+    std::thread::id _rootThread;
+    ProceduralContextPtr _context;
 };
 
 } // namespace ds_mfk
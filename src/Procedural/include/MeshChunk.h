@@ -0,0 +1,105 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#ifndef MESHCHUNK_H
+#define MESHCHUNK_H
+
+#include <memory>
+#include <vector>
+
+#include <GA/GA_Types.h>
+#include <UT/UT_BoundingBox.h>
+
+#include <FnAttribute/FnAttribute.h>
+
+namespace FnKat = Foundry::Katana;
+
+namespace ds_mfk {
+
+// Spatially coherent subset of the faces of a large mesh, built by its own
+// procedural when Mantra first reaches its bound.
+struct MeshChunk
+{
+    // Katana faces of the chunk, in increasing order. Faces with no vertices
+    // are never part of a chunk.
+    std::vector<GA_Size> faces;
+
+    // Bound of the chunk vertices, in the mesh space until the chunk is
+    // handed to its procedural, in world space after.
+    UT_BoundingBox bbox;
+};
+
+typedef std::shared_ptr<const MeshChunk> MeshChunkPtr;
+
+// Topology of a chunk, remapped to the points it uses.
+struct MeshChunkTopology
+{
+    // Katana point and vertex of each element of the chunk, in increasing
+    // order.
+    std::vector<GA_Size> points;
+    std::vector<GA_Size> vertices;
+
+    std::vector<float> positions;
+    std::vector<int> startIndex;
+    std::vector<int> vertexList;
+};
+
+// Splits the faces of a mesh into chunks of at most 'maxFaces' faces, by
+// recursive median splits of the face centers along the longest axis of
+// their bound.
+std::vector<MeshChunk> splitMesh(const FnKat::FloatConstVector& points,
+                                 const FnKat::IntConstVector& startIndex,
+                                 const FnKat::IntConstVector& vertexList,
+                                 GA_Size maxFaces);
+
+// Extracts the faces of 'chunk' out of the whole mesh. 'startIndex' ends
+// with the size of the vertex list, as in Katana.
+void extractMeshChunk(const MeshChunk& chunk,
+                      const FnKat::FloatConstVector& points,
+                      const FnKat::IntConstVector& startIndex,
+                      const FnKat::IntConstVector& vertexList,
+                      MeshChunkTopology& topology);
+
+} // namespace ds_mfk
+
+#endif // MESHCHUNK_H
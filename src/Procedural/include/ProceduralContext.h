@@ -0,0 +1,127 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#ifndef PROCEDURALCONTEXT_H
+#define PROCEDURALCONTEXT_H
+
+#include <cstdint>
+#include <memory>
+
+#include <UT/UT_Lock.h>
+
+#include "BoundCache.h"
+#include "CameraFrustum.h"
+#include "DiskGeometryCache.h"
+#include "GeometryCache.h"
+#include "InstanceSourceCache.h"
+#include "MaterialCache.h"
+#include "ProceduralSettings.h"
+#include "ResidencyManager.h"
+#include "TransformCache.h"
+#include "TranslationStats.h"
+
+namespace ds_mfk {
+
+// State shared by the main procedural and all the procedurals it generates.
+// Procedurals can be rendered concurrently by Mantra, so every shared member
+// takes care of its own locking.
+class ProceduralContext
+{
+public:
+    ProceduralContext(const ProceduralSettings& settings)
+        : _settings(settings), _diskGeometryCache(settings.geometryCacheDir),
+          _residencyManager(settings.geometryBudget, settings.geometryCacheDir),
+          _translationStats(settings.statsFile), _cameraFrustum(settings),
+          _pendingProcedurals(0)
+    {}
+    ~ProceduralContext() {}
+
+    // Declares a procedural handed to Mantra, and its end of render. Once no
+    // declared procedural is left to render the translation is over: the
+    // caches are released and the statistics written.
+    void addProcedural();
+    void finishProcedural();
+
+    const ProceduralSettings& getSettings() const { return _settings; }
+    GeometryCache& getGeometryCache() { return _geometryCache; }
+    BoundCache& getBoundCache() { return _boundCache; }
+    MaterialCache& getMaterialCache() { return _materialCache; }
+    TransformCache& getTransformCache() { return _transformCache; }
+    TranslationStats& getTranslationStats() { return _translationStats; }
+    const CameraFrustum& getCameraFrustum() const { return _cameraFrustum; }
+    ResidencyManager& getResidencyManager() { return _residencyManager; }
+    const DiskGeometryCache& getDiskGeometryCache() const
+    {
+        return _diskGeometryCache;
+    }
+    InstanceSourceCache& getInstanceSourceCache()
+    {
+        return _instanceSourceCache;
+    }
+
+private:
+    ProceduralContext(const ProceduralContext&);
+    ProceduralContext& operator=(const ProceduralContext&);
+
+    const ProceduralSettings _settings;
+    GeometryCache _geometryCache;
+    const DiskGeometryCache _diskGeometryCache;
+    BoundCache _boundCache;
+    MaterialCache _materialCache;
+    TransformCache _transformCache;
+    ResidencyManager _residencyManager;
+
+    TranslationStats _translationStats;
+
+    const CameraFrustum _cameraFrustum;
+    InstanceSourceCache _instanceSourceCache;
+
+    UT_Lock _lock;
+    int64_t _pendingProcedurals;
+};
+
+typedef std::shared_ptr<ProceduralContext> ProceduralContextPtr;
+
+} // namespace ds_mfk
+
+#endif // PROCEDURALCONTEXT_H
@@ -44,22 +44,57 @@
 #ifndef PROCEDURALITERATOR_H
 #define PROCEDURALITERATOR_H
 
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
 #include <GU/GU_Detail.h>
+#include <GU/GU_DetailHandle.h>
 #include <UT/UT_BoundingBox.h>
+#include <UT/UT_Lock.h>
+#include <UT/UT_Matrix4.h>
 #include <VRAY/VRAY_Procedural.h>
 
 #include <FnScenegraphIterator/FnScenegraphIterator.h>
 
+#include "AttributeTransfer.h"
+#include "MeshChunk.h"
+#include "ProceduralContext.h"
+
 namespace FnKat = Foundry::Katana;
 
 namespace ds_mfk {
 
 // Procedural responsible to translate Katana iterators into Houdini objects.
+//
+// Scenegraph iterators belong to the Geolib client of the thread that created
+// them, and are never used by another thread: locations translated or
+// rendered elsewhere are looked up again, by path, through the client of the
+// calling thread.
 class ProceduralIterator : public VRAY_Procedural
 {
 public:
-    ProceduralIterator(FnKat::FnScenegraphIterator iterator)
-        : _sgIterator(iterator) {}
+    ProceduralIterator(FnKat::FnScenegraphIterator iterator,
+                       ProceduralContextPtr context)
+        : _sgIterator(iterator), _sgPath(iterator.getFullName()),
+          _sgThread(std::this_thread::get_id()), _context(context) {}
+
+    // Procedural building a single chunk of the mesh at 'iterator'
+    ProceduralIterator(FnKat::FnScenegraphIterator iterator,
+                       ProceduralContextPtr context, MeshChunkPtr meshChunk)
+        : _sgIterator(iterator), _sgPath(iterator.getFullName()),
+          _sgThread(std::this_thread::get_id()), _context(context),
+          _meshChunk(meshChunk) {}
+
+    // Procedural of the location at 'path', whose 'iterator' belongs to
+    // 'thread'. The iterator is only used by that thread.
+    ProceduralIterator(FnKat::FnScenegraphIterator iterator,
+                       const std::string& path, std::thread::id thread,
+                       ProceduralContextPtr context,
+                       MeshChunkPtr meshChunk = MeshChunkPtr())
+        : _sgIterator(iterator), _sgPath(path), _sgThread(thread),
+          _context(context), _meshChunk(meshChunk) {}
     virtual ~ProceduralIterator() {}
 
     const char* getClassName();
@@ -69,18 +104,136 @@ public:
     void render() override;
 
 private:
-    void renderLocation(FnKat::FnScenegraphIterator sgIterator);
-    void processLocation(FnKat::FnScenegraphIterator sgIterator);
-    void processGroup(FnKat::FnScenegraphIterator sgIterator);
-    GU_Detail* processPoly(FnKat::FnScenegraphIterator iterator,
-                           void* optionalInput);
+    // Translated data of a location, waiting to be handed to Mantra.
+    struct TranslatedLocation
+    {
+        TranslatedLocation(FnKat::FnScenegraphIterator sgIterator)
+            : iterator(sgIterator), materialIterator(sgIterator),
+              path(sgIterator.getFullName()), materialPath(path),
+              thread(std::this_thread::get_id()), deferred(false),
+              velocityBlur(false) {}
+
+        FnKat::FnScenegraphIterator iterator;
+        FnKat::FnScenegraphIterator materialIterator;
+
+        // Instance placing a source element, whose object settings override
+        // the element ones. Invalid for other locations.
+        FnKat::FnScenegraphIterator instanceIterator;
+
+        // Paths of the iterators, and the thread owning them
+        std::string path;
+        std::string materialPath;
+        std::string instancePath;
+        std::thread::id thread;
+
+        bool deferred;
+
+        // Geometry of the object, one detail per shutter offset
+        std::vector<std::pair<fpreal, GU_Detail*> > geometry;
+
+        // Motion is computed at render time from the 'v' point attribute
+        bool velocityBlur;
+
+        // World transform samples, when not given by the location itself
+        std::vector<UT_Matrix4D> xforms;
+
+        std::vector<TranslatedLocation> children;
+
+        // Large meshes are split in chunks, each deferred to its procedural
+        std::vector<MeshChunkPtr> chunks;
+
+        LocationStats stats;
+    };
+
+    // Returns 'iterator', at 'path' and owned by 'thread', or the same
+    // location read through the Geolib client of the calling thread.
+    FnKat::FnScenegraphIterator getThreadIterator(
+        FnKat::FnScenegraphIterator iterator, const std::string& path,
+        std::thread::id thread) const;
+    void bindToThread(TranslatedLocation& location) const;
+
+    // Translation: can run concurrently on sibling subtrees
+    void processLocation(TranslatedLocation& location);
+    void processGroup(TranslatedLocation& location);
+    bool isLocationRendered(FnKat::FnScenegraphIterator iterator) const;
+    void selectLevelOfDetail(TranslatedLocation& location) const;
+    void processMesh(TranslatedLocation& location);
+    bool processMeshChunks(TranslatedLocation& location);
+    std::string getGeometryKey(FnKat::FnScenegraphIterator iterator) const;
+    bool spillMesh(FnKat::FnScenegraphIterator iterator,
+                   const std::string& key);
+    GU_ConstDetailHandle processSharedMesh(
+        FnKat::FnScenegraphIterator iterator, bool* converted = nullptr);
+    void processInstance(TranslatedLocation& location);
+    void processInstanceArray(TranslatedLocation& location);
+    InstanceSourcePtr processInstanceSource(
+        FnKat::FnScenegraphIterator iterator);
+    void collectInstanceSourceElements(
+        FnKat::FnScenegraphIterator iterator, const UT_Matrix4D& sourceXform,
+        InstanceSource& source);
+
+    // A 'motionSample' only holds the topology, the positions and the
+    // attributes varying over time, as Mantra takes the others from the
+    // first deformation sample.
+    bool processGeometry(FnKat::FnScenegraphIterator iterator,
+                         GU_Detail* gdp, float sampleTime = 0.0f,
+                         bool motionSample = false);
+    bool processPoly(FnKat::FnScenegraphIterator iterator, GU_Detail* gdp,
+                     float sampleTime = 0.0f, bool motionSample = false);
+    void processFacesets(FnKat::FnScenegraphIterator iterator, GU_Detail* gdp,
+                         const AttributeTarget& target);
+    bool processCurves(FnKat::FnScenegraphIterator iterator, GU_Detail* gdp,
+                       float sampleTime = 0.0f, bool motionSample = false);
+    bool processPointCloud(FnKat::FnScenegraphIterator iterator,
+                           GU_Detail* gdp, float sampleTime = 0.0f,
+                           bool motionSample = false);
+    void processWidth(const FnKat::GroupAttribute& geometryGroupAttr,
+                      GU_Detail* gdp, GA_Offset startPtOff, GA_Size numPoints,
+                      float sampleTime, bool motionSample);
+    std::vector<float> getGeometrySampleTimes(
+        const FnKat::DataAttribute& attr) const;
+    GU_Detail* allocateLocationGeometry();
+    void freeLocationGeometry(GU_Detail* gdp);
+    void recordStats(TranslatedLocation& location, const std::string& type,
+                     double convertTime);
+
+    // Object creation: always serialized, in scenegraph order
+    void renderLocation(const TranslatedLocation& location);
+    void processRayVisibility(FnKat::FnScenegraphIterator iterator);
     void processTransform(FnKat::FnScenegraphIterator iterator);
+    void processTransform(const std::vector<UT_Matrix4D>& xforms);
+    const std::vector<UT_Matrix4D>& getWorldXforms(
+        FnKat::FnScenegraphIterator iterator) const;
+    void computeWorldXforms(FnKat::FnScenegraphIterator iterator,
+                            std::vector<UT_Matrix4D>& xforms) const;
+    bool getLocationBound(FnKat::FnScenegraphIterator iterator,
+                          UT_BoundingBox& bbox) const;
+
+    // Bounds of locations with no 'bound' attribute, measured on their
+    // geometry and memoized in the context
+    bool getComputedBound(FnKat::FnScenegraphIterator iterator,
+                          UT_BoundingBox& bbox) const;
+    bool computeLocationBound(FnKat::FnScenegraphIterator iterator,
+                              UT_BoundingBox& bbox) const;
+    bool getInstanceSourceBound(FnKat::FnScenegraphIterator iterator,
+                                UT_BoundingBox& bbox) const;
+    bool computeInstanceBound(FnKat::FnScenegraphIterator iterator,
+                              UT_BoundingBox& bbox) const;
+    bool computeInstanceArrayBound(FnKat::FnScenegraphIterator iterator,
+                                   UT_BoundingBox& bbox) const;
 
     template <typename T>
     std::string buildPropertyString(T attr) const;
     void processMaterial(FnKat::FnScenegraphIterator iterator);
+    std::string getShaderString(const FnKat::GroupAttribute& matAttr) const;
+    std::string buildShaderString(const FnKat::GroupAttribute& matAttr) const;
 
     FnKat::FnScenegraphIterator _sgIterator;
+    std::string _sgPath;
+    std::thread::id _sgThread;
+    ProceduralContextPtr _context;
+    MeshChunkPtr _meshChunk;
+    UT_Lock _geometryLock;
 };
 
 } // namespace ds_mfk
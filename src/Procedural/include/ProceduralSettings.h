@@ -0,0 +1,155 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#ifndef PROCEDURALSETTINGS_H
+#define PROCEDURALSETTINGS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ds_mfk {
+
+// Options imported by the main procedural and shared with all the procedurals
+// it generates.
+struct ProceduralSettings
+{
+    ProceduralSettings()
+        : deferredExpansion(true), parallelTranslation(true),
+          deduplicateGeometry(true), shutterOpen(0.0f), shutterClose(0.0f),
+          sampleTimes(1, 0.0f), framesPerSecond(24.0f),
+          geometryBudget(0), renderPointsAs(0), frustumCulling(false),
+          cullingMargin(0.0f), cameraFov(0.0f), lodLevel(-1),
+          meshChunkFaces(0)
+    {
+        cameraResolution[0] = 0;
+        cameraResolution[1] = 0;
+        cameraClip[0] = 0.1f;
+        cameraClip[1] = 100000.0f;
+    }
+
+    // Converts a Katana sample time into a Mantra shutter offset, in the
+    // [0, 1] range.
+    float getShutterOffset(float sampleTime) const
+    {
+        if (shutterClose <= shutterOpen)
+        {
+            return 0.0f;
+        }
+
+        const float offset =
+            (sampleTime - shutterOpen) / (shutterClose - shutterOpen);
+        return std::min(std::max(offset, 0.0f), 1.0f);
+    }
+
+    // Locations providing a 'bound' attribute are expanded by a dedicated
+    // child procedural, only when Mantra needs them.
+    bool deferredExpansion;
+
+    // Sibling subtrees are cooked and converted concurrently, each thread
+    // reading the scenegraph through its own Geolib client.
+    bool parallelTranslation;
+
+    // Render script the scenegraph is read from
+    std::string scriptPath;
+
+    // Meshes with identical geometry attributes are converted once and
+    // instanced by all the locations using them. Subdivision meshes are
+    // always converted per location.
+    bool deduplicateGeometry;
+
+    // Shutter interval, relative to the current frame
+    float shutterOpen;
+    float shutterClose;
+
+    // Times at which transforms are sampled, evenly spread over the shutter
+    // interval. A single sample disables transform motion blur.
+    std::vector<float> sampleTimes;
+
+    // Converts the shutter interval into seconds for velocity blur, as point
+    // velocities are expressed in units per second.
+    float framesPerSecond;
+
+    // Directory where converted static meshes are stored and reused across
+    // renders. Empty to disable the disk cache.
+    std::string geometryCacheDir;
+
+    // Bytes of generated geometry kept in memory before static meshes are
+    // spilled to disk. Zero for no limit.
+    int64_t geometryBudget;
+
+    // Shape of the points of pointcloud locations: 0 for spheres, 1 for
+    // camera facing discs.
+    int renderPointsAs;
+
+    // JSON file receiving the translation statistics at the end of the
+    // render. Empty to disable them.
+    std::string statsFile;
+
+    // Locations whose bound lies outside the render camera view, enlarged by
+    // cullingMargin in world units, are not translated.
+    bool frustumCulling;
+    float cullingMargin;
+
+    // Render camera: field of view in degrees, image resolution, near and
+    // far clipping planes, and camera to world transforms with 16 values per
+    // sample. No transform when the camera is unknown.
+    float cameraFov;
+    int cameraResolution[2];
+    float cameraClip[2];
+    std::vector<double> cameraXforms;
+
+    // Child of the level-of-detail groups to render, the highest detail
+    // being 0. Negative to select it from the screen size of the groups.
+    int lodLevel;
+
+    // Static polymeshes with more faces are split spatially in chunks of at
+    // most this many faces, each built by its own procedural. Zero to
+    // disable the splitting.
+    int64_t meshChunkFaces;
+};
+
+} // namespace ds_mfk
+
+#endif // PROCEDURALSETTINGS_H
@@ -0,0 +1,121 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#ifndef RESIDENCYMANAGER_H
+#define RESIDENCYMANAGER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_set>
+
+#include <UT/UT_Lock.h>
+
+#include "DiskGeometryCache.h"
+
+namespace ds_mfk {
+
+// Keeps the geometry generated by the procedurals within a memory budget.
+//
+// Geometry handed to Mantra cannot be taken back, so the budget is enforced
+// on what is generated next: the bytes of every emitted location and of
+// every shared mesh are counted as resident until the end of the render,
+// each shared mesh once whatever the number of objects packing it. Once the
+// budget is exceeded new shared meshes are spilled to disk instead, and
+// rendered as PackedDisk primitives loaded and unloaded on demand by the
+// Mantra geometry cache. Meshes that are not shared (subdivision, deforming,
+// velocity blurred and chunked meshes) always stay in memory.
+class ResidencyManager
+{
+public:
+    // A null 'budget' disables the manager. Meshes are spilled to
+    // 'spillDirectory', or to a temporary directory under $TMPDIR created
+    // with the first spilled mesh and removed on destruction.
+    ResidencyManager(int64_t budget, const std::string& spillDirectory);
+    ~ResidencyManager();
+
+    bool isEnabled() const { return _budget > 0; }
+
+    // Returns true when new geometry should be spilled to disk.
+    bool isOverBudget() const;
+
+    // Adds the bytes of geometry emitted for a location.
+    void addLocation(int64_t bytes);
+
+    // Adds the bytes of the shared mesh 'key', unless already counted.
+    void addMesh(const std::string& key, int64_t bytes);
+
+    // Returns true if meshes can still be spilled to disk.
+    bool canSpill() const;
+
+    // Returns true if the mesh 'key' was spilled to disk.
+    bool isMeshSpilled(const std::string& key) const;
+
+    // Writes the mesh 'key' to the spill directory.
+    bool spillMesh(const std::string& key, GU_Detail& gdp);
+
+    // Returns the file holding the spilled mesh 'key'.
+    std::string getSpillPath(const std::string& key) const;
+
+private:
+    ResidencyManager(const ResidencyManager&);
+    ResidencyManager& operator=(const ResidencyManager&);
+
+    const DiskGeometryCache* getSpillCache() const;
+
+    const int64_t _budget;
+    const std::string _spillDirectory;
+
+    mutable UT_Lock _lock;
+    int64_t _locationBytes;
+    std::unordered_set<std::string> _meshes;
+    int64_t _meshBytes;
+
+    std::string _tmpDirectory;
+    bool _spillFailed;
+    std::unique_ptr<DiskGeometryCache> _spillCache;
+};
+
+} // namespace ds_mfk
+
+#endif // RESIDENCYMANAGER_H
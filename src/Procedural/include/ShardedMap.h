@@ -0,0 +1,123 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#ifndef SHARDEDMAP_H
+#define SHARDEDMAP_H
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#include <UT/UT_Lock.h>
+
+namespace ds_mfk {
+
+// Thread safe map from strings, split in shards each guarded by its own lock
+// so that concurrent accesses to different keys rarely contend. Values are
+// never replaced nor erased until clear(), and unordered_map nodes do not
+// move, so references to them stay valid without holding any lock.
+template <typename T>
+class ShardedMap
+{
+public:
+    ShardedMap() {}
+    ~ShardedMap() {}
+
+    // Returns the value stored for 'key', or null.
+    const T* find(const std::string& key) const
+    {
+        const Shard& shard = getShard(key);
+        UT_AutoLock lock(shard.lock);
+
+        auto it = shard.values.find(key);
+        return it != shard.values.end() ? &it->second : nullptr;
+    }
+
+    // Stores 'value' for 'key', unless a value is already stored. Returns
+    // the value held by the map.
+    const T& insert(const std::string& key, const T& value)
+    {
+        Shard& shard = getShard(key);
+        UT_AutoLock lock(shard.lock);
+
+        return shard.values.insert(std::make_pair(key, value)).first->second;
+    }
+
+    // Invalidates all the references returned so far.
+    void clear()
+    {
+        for (size_t i = 0; i < kNumShards; ++i)
+        {
+            UT_AutoLock lock(_shards[i].lock);
+            _shards[i].values.clear();
+        }
+    }
+
+private:
+    ShardedMap(const ShardedMap&);
+    ShardedMap& operator=(const ShardedMap&);
+
+    static const size_t kNumShards = 64;
+
+    struct Shard
+    {
+        mutable UT_Lock lock;
+        std::unordered_map<std::string, T> values;
+    };
+
+    const Shard& getShard(const std::string& key) const
+    {
+        return _shards[std::hash<std::string>()(key) % kNumShards];
+    }
+
+    Shard& getShard(const std::string& key)
+    {
+        return _shards[std::hash<std::string>()(key) % kNumShards];
+    }
+
+    Shard _shards[kNumShards];
+};
+
+} // namespace ds_mfk
+
+#endif // SHARDEDMAP_H
@@ -0,0 +1,88 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#ifndef TRANSFORMCACHE_H
+#define TRANSFORMCACHE_H
+
+#include <string>
+#include <vector>
+
+#include <UT/UT_Matrix4.h>
+
+#include "ShardedMap.h"
+
+namespace ds_mfk {
+
+// Thread safe map between location paths and their world transform samples.
+// Each location combines its local transform with the one stored for its
+// parent, so ancestors are only evaluated once whatever the depth of the
+// hierarchy. An empty list of samples stands for the identity.
+//
+// Translation threads mostly read transforms already stored, so the map is
+// sharded and samples are handed out by reference instead of copied.
+class TransformCache
+{
+public:
+    TransformCache() {}
+    ~TransformCache() {}
+
+    // Returns the samples stored for 'path', or null.
+    const std::vector<UT_Matrix4D>* find(const std::string& path) const;
+
+    // Stores 'xforms' for 'path', unless already stored by another thread.
+    // Returns the samples held by the cache.
+    const std::vector<UT_Matrix4D>& insert(
+        const std::string& path, const std::vector<UT_Matrix4D>& xforms);
+
+    void clear();
+
+private:
+    TransformCache(const TransformCache&);
+    TransformCache& operator=(const TransformCache&);
+
+    ShardedMap<std::vector<UT_Matrix4D> > _xforms;
+};
+
+} // namespace ds_mfk
+
+#endif // TRANSFORMCACHE_H
@@ -0,0 +1,154 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#ifndef TRANSLATIONSTATS_H
+#define TRANSLATIONSTATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <GU/GU_Detail.h>
+#include <UT/UT_Lock.h>
+
+namespace ds_mfk {
+
+// Seconds elapsed since construction or since the previous lap.
+class StatsTimer
+{
+public:
+    StatsTimer() : _start(std::chrono::steady_clock::now()) {}
+
+    double lap()
+    {
+        const std::chrono::steady_clock::time_point now =
+            std::chrono::steady_clock::now();
+        const double seconds =
+            std::chrono::duration<double>(now - _start).count();
+        _start = now;
+        return seconds;
+    }
+
+private:
+    std::chrono::steady_clock::time_point _start;
+};
+
+// Cost of translating a single location. 'cookTime' is spent by Geolib to
+// produce the location, 'convertTime' to build its Houdini geometry.
+struct LocationStats
+{
+    LocationStats()
+        : cookTime(0.0), convertTime(0.0), numPoints(0), numPrimitives(0),
+          numVertices(0), bytes(0) {}
+
+    // Accumulates the element counts and memory of 'gdp'.
+    void addGeometry(const GU_Detail& gdp);
+
+    std::string path;
+    std::string type;
+    double cookTime;
+    double convertTime;
+    int64_t numPoints;
+    int64_t numPrimitives;
+    int64_t numVertices;
+    int64_t bytes;
+};
+
+// Thread safe aggregation of the location statistics, written as a JSON
+// report once every expanded procedural has been rendered, or when
+// destroyed if Mantra never expanded some of them. Only totals per location
+// type and the slowest and largest locations are kept, so the memory used
+// does not grow with the size of the scene.
+class TranslationStats
+{
+public:
+    // An empty 'reportPath' disables the statistics.
+    TranslationStats(const std::string& reportPath);
+    ~TranslationStats();
+
+    bool isEnabled() const { return !_reportPath.empty(); }
+
+    void record(const LocationStats& stats);
+
+    // Writes the report at the end of the translation. It is written again
+    // on destruction if locations were recorded in the meantime.
+    void finish();
+
+    bool writeReport() const;
+
+private:
+    TranslationStats(const TranslationStats&);
+    TranslationStats& operator=(const TranslationStats&);
+
+    struct Totals
+    {
+        Totals()
+            : numLocations(0), cookTime(0.0), convertTime(0.0),
+              numPoints(0), numPrimitives(0), numVertices(0), bytes(0) {}
+
+        void add(const LocationStats& stats);
+
+        int64_t numLocations;
+        double cookTime;
+        double convertTime;
+        int64_t numPoints;
+        int64_t numPrimitives;
+        int64_t numVertices;
+        int64_t bytes;
+    };
+
+    const std::string _reportPath;
+
+    mutable UT_Lock _lock;
+    bool _written;
+    Totals _totals;
+    std::map<std::string, Totals> _typeTotals;
+    std::vector<LocationStats> _slowest;
+    std::vector<LocationStats> _largest;
+};
+
+} // namespace ds_mfk
+
+#endif // TRANSLATIONSTATS_H
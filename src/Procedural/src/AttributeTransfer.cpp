@@ -0,0 +1,525 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#include <cctype>
+#include <iostream>
+#include <string>
+#include <type_traits>
+
+#include <GA/GA_Handle.h>
+#include <GA/GA_Range.h>
+#include <UT/UT_ParallelUtil.h>
+
+#include "AttributeTransfer.h"
+
+namespace ds_mfk {
+
+namespace {
+
+// Katana attribute to transfer, with its values still in Katana storage.
+struct AttributeSource
+{
+    AttributeSource() : tupleSize(0), typeInfo(GA_TYPE_VOID) {}
+
+    std::string name;
+    std::string scope;
+    int tupleSize;
+    GA_TypeInfo typeInfo;
+    FnKat::Attribute value;
+    FnKat::IntAttribute index;
+};
+
+// Destination elements of a scope
+struct AttributeElements
+{
+    AttributeElements()
+        : owner(GA_ATTRIB_DETAIL), startOffset(0), numElements(1),
+          elementMap(nullptr) {}
+
+    GA_AttributeOwner owner;
+    GA_Offset startOffset;
+    GA_Size numElements;
+    const std::vector<GA_Size>* elementMap;
+};
+
+// GA storage of each Katana attribute type. Numeric values are written page
+// by page with the GA block accessors, strings go through the string table
+// and are set one element at a time.
+template <typename AttrT>
+struct AttributeTraits;
+
+template <typename T>
+void writeNumericValues(GU_Detail* gdp, GA_Attribute* attrib,
+                        const AttributeElements& elements, const T* values,
+                        int tupleSize)
+{
+    GA_RWHandleT<T> handle(attrib);
+    if (elements.owner == GA_ATTRIB_DETAIL)
+    {
+        for (int c = 0; c < tupleSize; ++c)
+        {
+            handle.set(GA_Offset(0), c, values[c]);
+        }
+        return;
+    }
+
+    const GA_IndexMap& indexMap =
+        elements.owner == GA_ATTRIB_POINT ? gdp->getPointMap()
+        : elements.owner == GA_ATTRIB_VERTEX ? gdp->getVertexMap()
+        : gdp->getPrimitiveMap();
+    const GA_Offset startOff = elements.startOffset;
+    const GA_Range range(indexMap, startOff, startOff + elements.numElements);
+
+    UTparallelForLightItems(GA_SplittableRange(range),
+        [&](const GA_SplittableRange& subRange)
+        {
+            GA_Offset start;
+            GA_Offset end;
+            for (GA_Iterator it(subRange); it.blockAdvance(start, end);)
+            {
+                const T* src = values + (start - startOff) * tupleSize;
+                for (int c = 0; c < tupleSize; ++c)
+                {
+                    handle.setBlock(start, end - start, src + c, tupleSize, c);
+                }
+            }
+        });
+}
+
+inline const char* toCString(const std::string& value)
+{
+    return value.c_str();
+}
+
+inline const char* toCString(const char* value)
+{
+    return value;
+}
+
+template <>
+struct AttributeTraits<FnKat::FloatAttribute>
+{
+    static GA_Attribute* add(GU_Detail* gdp, GA_AttributeOwner owner,
+                             const char* name, int tupleSize)
+    {
+        return gdp->addFloatTuple(owner, name, tupleSize);
+    }
+
+    template <typename T>
+    static void write(GU_Detail* gdp, GA_Attribute* attrib,
+                      const AttributeElements& elements, const T* values,
+                      int tupleSize)
+    {
+        writeNumericValues(gdp, attrib, elements, values, tupleSize);
+    }
+};
+
+template <>
+struct AttributeTraits<FnKat::DoubleAttribute>
+{
+    static GA_Attribute* add(GU_Detail* gdp, GA_AttributeOwner owner,
+                             const char* name, int tupleSize)
+    {
+        return gdp->addFloatTuple(owner, name, tupleSize, GA_Defaults(0.0),
+                                  0, 0, GA_STORE_REAL64);
+    }
+
+    template <typename T>
+    static void write(GU_Detail* gdp, GA_Attribute* attrib,
+                      const AttributeElements& elements, const T* values,
+                      int tupleSize)
+    {
+        writeNumericValues(gdp, attrib, elements, values, tupleSize);
+    }
+};
+
+template <>
+struct AttributeTraits<FnKat::IntAttribute>
+{
+    static GA_Attribute* add(GU_Detail* gdp, GA_AttributeOwner owner,
+                             const char* name, int tupleSize)
+    {
+        return gdp->addIntTuple(owner, name, tupleSize);
+    }
+
+    template <typename T>
+    static void write(GU_Detail* gdp, GA_Attribute* attrib,
+                      const AttributeElements& elements, const T* values,
+                      int tupleSize)
+    {
+        writeNumericValues(gdp, attrib, elements, values, tupleSize);
+    }
+};
+
+template <>
+struct AttributeTraits<FnKat::StringAttribute>
+{
+    static GA_Attribute* add(GU_Detail* gdp, GA_AttributeOwner owner,
+                             const char* name, int tupleSize)
+    {
+        return gdp->addStringTuple(owner, name, tupleSize);
+    }
+
+    template <typename T>
+    static void write(GU_Detail* gdp, GA_Attribute* attrib,
+                      const AttributeElements& elements, const T* values,
+                      int tupleSize)
+    {
+        GA_RWHandleS handle(attrib);
+        for (GA_Size i = 0; i < elements.numElements; ++i)
+        {
+            for (int c = 0; c < tupleSize; ++c)
+            {
+                handle.set(elements.startOffset + i, c,
+                           toCString(values[i * tupleSize + c]));
+            }
+        }
+    }
+};
+
+// Number of components of a Katana arbitrary 'inputType', given by its
+// trailing digits ('float', 'int' and 'string' hold a single value).
+int getInputTypeSize(const std::string& inputType)
+{
+    size_t pos = inputType.size();
+    while (pos > 0 && std::isdigit(inputType[pos - 1]))
+    {
+        --pos;
+    }
+
+    return pos < inputType.size() ? std::stoi(inputType.substr(pos)) : 1;
+}
+
+GA_TypeInfo getInputTypeInfo(const std::string& inputType)
+{
+    if (inputType.compare(0, 5, "point") == 0)
+    {
+        return GA_TYPE_POINT;
+    }
+    if (inputType.compare(0, 6, "vector") == 0)
+    {
+        return GA_TYPE_VECTOR;
+    }
+    if (inputType.compare(0, 6, "normal") == 0)
+    {
+        return GA_TYPE_NORMAL;
+    }
+    if (inputType.compare(0, 5, "color") == 0)
+    {
+        return GA_TYPE_COLOR;
+    }
+
+    return GA_TYPE_VOID;
+}
+
+bool getAttributeElements(const std::string& scope,
+                          const AttributeTarget& target,
+                          AttributeElements& elements)
+{
+    if (scope == "point")
+    {
+        elements.owner = GA_ATTRIB_POINT;
+        elements.startOffset = target.startPointOffset;
+        elements.numElements = target.numPoints;
+        if (!target.sourcePoints.empty())
+        {
+            elements.elementMap = &target.sourcePoints;
+            elements.numElements = target.sourcePoints.size();
+        }
+    }
+    else if (scope == "vertex")
+    {
+        elements.owner = GA_ATTRIB_VERTEX;
+        elements.startOffset = target.startVertexOffset;
+        elements.numElements = target.numVertices;
+        if (!target.sourceVertices.empty())
+        {
+            elements.elementMap = &target.sourceVertices;
+            elements.numElements = target.sourceVertices.size();
+        }
+    }
+    else if (scope == "face")
+    {
+        elements.owner = GA_ATTRIB_PRIMITIVE;
+        elements.startOffset = target.startPrimitiveOffset;
+        elements.numElements = target.numFaces;
+        if (!target.primitiveFaces.empty())
+        {
+            elements.elementMap = &target.primitiveFaces;
+            elements.numElements = target.primitiveFaces.size();
+        }
+    }
+    else if (scope == "primitive")
+    {
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+
+    return elements.startOffset != GA_INVALID_OFFSET
+        && elements.numElements > 0;
+}
+
+template <typename AttrT>
+void transferValues(GU_Detail* gdp, const AttributeSource& source,
+                    const AttributeElements& elements, float sampleTime)
+{
+    const AttrT valueAttr(source.value);
+    const auto values = valueAttr.getNearestSample(sampleTime);
+    typedef typename std::remove_cv<typename std::remove_reference<
+        decltype(values[0])>::type>::type ElementT;
+
+    // Number of source values per element: explicit for arbitrary attributes,
+    // the Katana tuple size otherwise.
+    int tupleSize = source.tupleSize;
+    if (tupleSize <= 0)
+    {
+        tupleSize = valueAttr.getTupleSize();
+    }
+
+    const bool indexed = source.index.isValid();
+    const FnKat::IntConstVector index = source.index.getNearestSample(0.0f);
+    const GA_Size numSourceElements = elements.elementMap
+        ? elements.elementMap->back() + 1 : elements.numElements;
+    const GA_Size numValues = values.size();
+
+    const bool valid = tupleSize > 0
+        && (indexed ? static_cast<GA_Size>(index.size()) >= numSourceElements
+            : numValues >= numSourceElements * tupleSize);
+    if (!valid)
+    {
+        std::cerr << "Procedural warning: invalid size for attribute '"
+                  << source.name << "'\n";
+        return;
+    }
+
+    // Values are only copied when they need to be resolved through an index
+    // or when only part of the elements were built, otherwise they are written
+    // straight from the Katana attribute data.
+    const ElementT* src = values.data();
+    std::vector<ElementT> gathered;
+    if (indexed || elements.elementMap)
+    {
+        gathered.resize(elements.numElements * tupleSize);
+        for (GA_Size i = 0; i < elements.numElements; ++i)
+        {
+            GA_Size element =
+                elements.elementMap ? (*elements.elementMap)[i] : i;
+            if (indexed)
+            {
+                element = index[element];
+                if (element < 0 || (element + 1) * tupleSize > numValues)
+                {
+                    std::cerr << "Procedural warning: invalid index for "
+                              << "attribute '" << source.name << "'\n";
+                    return;
+                }
+            }
+
+            for (int c = 0; c < tupleSize; ++c)
+            {
+                gathered[i * tupleSize + c] = values[element * tupleSize + c];
+            }
+        }
+        src = gathered.data();
+    }
+
+    // Texture coordinates are always 3 components wide in Houdini, the extra
+    // components are left to their default.
+    int attribTupleSize = tupleSize;
+    if (source.typeInfo == GA_TYPE_TEXTURE_COORD && attribTupleSize < 3)
+    {
+        attribTupleSize = 3;
+    }
+
+    GA_Attribute* attrib = AttributeTraits<AttrT>::add(
+        gdp, elements.owner, source.name.c_str(), attribTupleSize);
+    if (!attrib)
+    {
+        std::cerr << "Procedural warning: unable to create attribute '"
+                  << source.name << "'\n";
+        return;
+    }
+    attrib->setTypeInfo(source.typeInfo);
+
+    AttributeTraits<AttrT>::write(gdp, attrib, elements, src, tupleSize);
+}
+
+void transferAttribute(GU_Detail* gdp, const AttributeSource& source,
+                       const AttributeTarget& target, float sampleTime,
+                       bool varyingOnly)
+{
+    if (varyingOnly
+        && FnKat::DataAttribute(source.value).getNumberOfTimeSamples() <= 1)
+    {
+        return;
+    }
+
+    AttributeElements elements;
+    if (!getAttributeElements(source.scope, target, elements))
+    {
+        return;
+    }
+
+    // The element type is only inspected once per attribute, the copy itself
+    // is specialized for each of them.
+    if (FnKat::FloatAttribute(source.value).isValid())
+    {
+        transferValues<FnKat::FloatAttribute>(
+            gdp, source, elements, sampleTime);
+    }
+    else if (FnKat::DoubleAttribute(source.value).isValid())
+    {
+        transferValues<FnKat::DoubleAttribute>(
+            gdp, source, elements, sampleTime);
+    }
+    else if (FnKat::IntAttribute(source.value).isValid())
+    {
+        transferValues<FnKat::IntAttribute>(
+            gdp, source, elements, sampleTime);
+    }
+    else if (FnKat::StringAttribute(source.value).isValid())
+    {
+        transferValues<FnKat::StringAttribute>(
+            gdp, source, elements, sampleTime);
+    }
+}
+
+void transferArbitraryAttributes(GU_Detail* gdp,
+                                 const FnKat::GroupAttribute& arbitraryAttr,
+                                 const AttributeTarget& target,
+                                 float sampleTime, bool varyingOnly)
+{
+    for (int64_t i = 0; i < arbitraryAttr.getNumberOfChildren(); ++i)
+    {
+        FnKat::GroupAttribute childAttr = arbitraryAttr.getChildByIndex(i);
+        if (!childAttr.isValid())
+        {
+            continue;
+        }
+
+        AttributeSource source;
+        source.name = arbitraryAttr.getChildName(i);
+
+        FnKat::StringAttribute scopeAttr = childAttr.getChildByName("scope");
+        source.scope = scopeAttr.getValue("primitive", false);
+
+        FnKat::StringAttribute inputTypeAttr =
+            childAttr.getChildByName("inputType");
+        const std::string inputType = inputTypeAttr.getValue("", false);
+        if (!inputType.empty())
+        {
+            FnKat::IntAttribute elementSizeAttr =
+                childAttr.getChildByName("elementSize");
+            source.tupleSize = getInputTypeSize(inputType)
+                * elementSizeAttr.getValue(1, false);
+            source.typeInfo = getInputTypeInfo(inputType);
+        }
+
+        source.value = childAttr.getChildByName("value");
+        if (!source.value.isValid())
+        {
+            source.value = childAttr.getChildByName("indexedValue");
+            source.index = childAttr.getChildByName("index");
+            if (!source.index.isValid())
+            {
+                continue;
+            }
+        }
+
+        // Katana texture coordinates are named after the RenderMan ones
+        if (source.name == "st")
+        {
+            source.name = "uv";
+            source.typeInfo = GA_TYPE_TEXTURE_COORD;
+        }
+
+        transferAttribute(gdp, source, target, sampleTime, varyingOnly);
+    }
+}
+
+} // namespace
+
+void transferAttributes(GU_Detail* gdp,
+                        const FnKat::GroupAttribute& geometryAttr,
+                        const AttributeTarget& target,
+                        float sampleTime, bool varyingOnly)
+{
+    if (!geometryAttr.isValid())
+    {
+        return;
+    }
+
+    const char* normalScopes[] = { "point", "vertex" };
+    for (const char* scope : normalScopes)
+    {
+        FnKat::GroupAttribute scopeAttr = geometryAttr.getChildByName(scope);
+        if (!scopeAttr.isValid())
+        {
+            continue;
+        }
+
+        AttributeSource source;
+        source.name = "N";
+        source.scope = scope;
+        source.tupleSize = 3;
+        source.typeInfo = GA_TYPE_NORMAL;
+        source.value = scopeAttr.getChildByName("N");
+        if (source.value.isValid())
+        {
+            transferAttribute(gdp, source, target, sampleTime, varyingOnly);
+        }
+    }
+
+    FnKat::GroupAttribute arbitraryAttr =
+        geometryAttr.getChildByName("arbitrary");
+    if (arbitraryAttr.isValid())
+    {
+        transferArbitraryAttributes(gdp, arbitraryAttr, target, sampleTime,
+                                    varyingOnly);
+    }
+}
+
+} // namespace ds_mfk
@@ -0,0 +1,203 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "CameraFrustum.h"
+
+namespace ds_mfk {
+
+CameraFrustum::CameraFrustum(const ProceduralSettings& settings)
+    : _tanX(0.0), _tanY(0.0), _screenTanX(0.0), _screenTanY(0.0),
+      _near(settings.cameraClip[0]),
+      _far(settings.cameraClip[1]), _margin(settings.cullingMargin),
+      _culling(settings.frustumCulling)
+{
+    _resolution[0] = settings.cameraResolution[0];
+    _resolution[1] = settings.cameraResolution[1];
+    if (settings.cameraFov <= 0.0f || _resolution[0] <= 0
+        || _resolution[1] <= 0)
+    {
+        return;
+    }
+
+    // The field of view spans the smaller side of the image. Assuming so is
+    // also conservative when it spans the larger one.
+    const double tanFov = std::tan(settings.cameraFov * M_PI / 360.0);
+    const double aspect = static_cast<double>(_resolution[0]) / _resolution[1];
+    _tanX = tanFov * std::max(aspect, 1.0);
+    _tanY = tanFov * std::max(1.0 / aspect, 1.0);
+
+    // The render plug-in sets the camera zoom to 180 / (fov * pi), which
+    // Mantra applies to the image width: half the width at unit distance is
+    // 1 / (2 * zoom), and square pixels give the height.
+    _screenTanX = settings.cameraFov * M_PI / 360.0;
+    _screenTanY = _screenTanX / aspect;
+
+    for (size_t i = 0; i + 16 <= settings.cameraXforms.size(); i += 16)
+    {
+        UT_Matrix4D worldToCamera(
+            (double(*)[4])(settings.cameraXforms.data() + i));
+        if (worldToCamera.invert() != 0)
+        {
+            // Singular camera transform, nothing can be culled safely
+            _worldToCamera.clear();
+            return;
+        }
+        _worldToCamera.push_back(worldToCamera);
+    }
+}
+
+bool CameraFrustum::isOutside(const UT_BoundingBox& bbox) const
+{
+    if (!isEnabled() || !bbox.isValid())
+    {
+        return false;
+    }
+
+    const size_t numSamples = _worldToCamera.size();
+    std::vector<UT_Vector3D> corners(8 * numSamples);
+    for (size_t i = 0; i < numSamples; ++i)
+    {
+        for (int j = 0; j < 8; ++j)
+        {
+            const UT_Vector3D corner((j & 1) ? bbox.xmax() : bbox.xmin(),
+                                     (j & 2) ? bbox.ymax() : bbox.ymin(),
+                                     (j & 4) ? bbox.zmax() : bbox.zmin());
+            corners[8 * i + j] = corner * _worldToCamera[i];
+        }
+    }
+
+    // Between samples the corners move along arcs when the camera rotates,
+    // never further from the straight path than half the distance covered.
+    double motion = 0.0;
+    for (size_t i = 8; i < corners.size(); ++i)
+    {
+        motion = std::max(motion, (corners[i] - corners[i - 8]).length());
+    }
+    const double margin = _margin + 0.5 * motion;
+
+    // The box is outside during the whole shutter when all its corners are
+    // beyond the same plane at every sample. Boxes leaving the view through
+    // one side and coming back through another are kept.
+    for (int p = 0; p < 6; ++p)
+    {
+        bool outside = true;
+        for (size_t i = 0; i < corners.size() && outside; ++i)
+        {
+            outside = getPlaneDistance(p, corners[i]) > margin;
+        }
+
+        if (outside)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+double CameraFrustum::getScreenArea(const UT_BoundingBox& bbox) const
+{
+    if (!hasCamera() || !bbox.isValid())
+    {
+        return std::numeric_limits<double>::max();
+    }
+
+    double screenMin[2] = { std::numeric_limits<double>::max(),
+                            std::numeric_limits<double>::max() };
+    double screenMax[2] = { -std::numeric_limits<double>::max(),
+                            -std::numeric_limits<double>::max() };
+    for (int i = 0; i < 8; ++i)
+    {
+        const UT_Vector3D corner((i & 1) ? bbox.xmax() : bbox.xmin(),
+                                 (i & 2) ? bbox.ymax() : bbox.ymin(),
+                                 (i & 4) ? bbox.zmax() : bbox.zmin());
+        const UT_Vector3D cameraCorner = corner * _worldToCamera[0];
+
+        const double depth = -cameraCorner(2);
+        if (depth < _near)
+        {
+            return std::numeric_limits<double>::max();
+        }
+
+        // Pixel coordinates, relative to the image center
+        const double screen[2] =
+        {
+            cameraCorner(0) / (depth * _screenTanX) * _resolution[0] * 0.5,
+            cameraCorner(1) / (depth * _screenTanY) * _resolution[1] * 0.5
+        };
+        for (int j = 0; j < 2; ++j)
+        {
+            screenMin[j] = std::min(screenMin[j], screen[j]);
+            screenMax[j] = std::max(screenMax[j], screen[j]);
+        }
+    }
+
+    return (screenMax[0] - screenMin[0]) * (screenMax[1] - screenMin[1]);
+}
+
+double CameraFrustum::getPlaneDistance(int plane,
+                                      const UT_Vector3D& point) const
+{
+    // Camera space looks down -Z. Each plane is given by its unit outward
+    // normal.
+    const double normX = 1.0 / std::sqrt(1.0 + _tanX * _tanX);
+    const double normY = 1.0 / std::sqrt(1.0 + _tanY * _tanY);
+    const double planes[6][4] =
+    {
+        {  normX, 0.0, _tanX * normX, 0.0 },
+        { -normX, 0.0, _tanX * normX, 0.0 },
+        { 0.0,  normY, _tanY * normY, 0.0 },
+        { 0.0, -normY, _tanY * normY, 0.0 },
+        { 0.0, 0.0,  1.0,  _near },
+        { 0.0, 0.0, -1.0, -_far }
+    };
+
+    return planes[plane][0] * point(0) + planes[plane][1] * point(1)
+        + planes[plane][2] * point(2) + planes[plane][3];
+}
+
+} // namespace ds_mfk
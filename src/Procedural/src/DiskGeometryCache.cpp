@@ -0,0 +1,162 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "DiskGeometryCache.h"
+
+namespace ds_mfk {
+
+namespace {
+
+// Bumped whenever the conversion changes, so that files written by older
+// versions of the procedural are not picked up anymore.
+const char* kCacheVersion = "v2";
+
+// Detail attribute holding the full key of a cached file
+const char* kKeyAttribute = "cachekey";
+
+// 64 bits FNV-1a hash of 'key', starting from 'basis'
+uint64_t hashKey(const std::string& key, uint64_t basis)
+{
+    uint64_t hash = basis;
+    for (size_t i = 0; i < key.size(); ++i)
+    {
+        hash ^= static_cast<unsigned char>(key[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+} // namespace
+
+DiskGeometryCache::DiskGeometryCache(const std::string& directory)
+    : _directory(directory)
+{
+}
+
+std::string DiskGeometryCache::getPath(const std::string& key) const
+{
+    // Keys grow with the number of facesets, file names are limited to a
+    // fixed length digest of two independent hashes.
+    std::ostringstream path;
+    path << _directory << "/" << kCacheVersion << "_" << std::hex
+         << std::setfill('0')
+         << std::setw(16) << hashKey(key, 14695981039346656037ULL)
+         << std::setw(16) << hashKey(key, 0x84222325cbf29ce4ULL)
+         << ".bgeo.sc";
+    return path.str();
+}
+
+bool DiskGeometryCache::contains(const std::string& key) const
+{
+    struct stat fileStat;
+    return isEnabled() && stat(getPath(key).c_str(), &fileStat) == 0;
+}
+
+bool DiskGeometryCache::load(const std::string& key, GU_Detail* gdp) const
+{
+    if (!isEnabled())
+    {
+        return false;
+    }
+
+    if (!gdp->load(getPath(key).c_str()).success())
+    {
+        return false;
+    }
+
+    // Files sharing a digest with another key are ignored
+    GA_ROHandleS keyHandle(gdp->findAttribute(GA_ATTRIB_DETAIL,
+                                              kKeyAttribute));
+    return keyHandle.isValid()
+        && keyHandle.get(GA_Offset(0)).toStdString() == key;
+}
+
+bool DiskGeometryCache::save(const std::string& key, GU_Detail& gdp) const
+{
+    if (!isEnabled())
+    {
+        return false;
+    }
+
+    GA_RWHandleS keyHandle(gdp.addStringTuple(GA_ATTRIB_DETAIL,
+                                              kKeyAttribute, 1));
+    keyHandle.set(GA_Offset(0), key.c_str());
+
+    const std::string path = getPath(key);
+
+    // Unique per process and thread, the extension is kept last so that the
+    // compression is still inferred from it.
+    std::ostringstream tmpPath;
+    tmpPath << path.substr(0, path.size() - 8) << ".tmp" << getpid() << "_"
+            << std::hash<std::thread::id>()(std::this_thread::get_id())
+            << ".bgeo.sc";
+
+    if (!gdp.save(tmpPath.str().c_str(), nullptr).success())
+    {
+        std::cerr << "Procedural warning: unable to write geometry cache '"
+                  << tmpPath.str() << "'\n";
+        std::remove(tmpPath.str().c_str());
+        return false;
+    }
+
+    if (std::rename(tmpPath.str().c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmpPath.str().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace ds_mfk
@@ -0,0 +1,183 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#include <sys/stat.h>
+
+#include <RenderOutputUtils/RenderOutputUtils.h>
+
+#include "GeolibRuntime.h"
+
+namespace ds_mfk {
+
+GeolibRuntime& GeolibRuntime::getInstance()
+{
+    static GeolibRuntime runtime;
+    return runtime;
+}
+
+bool GeolibRuntime::bootstrap(const std::string& katanaRoot)
+{
+    UT_AutoLock lock(_lock);
+
+    // A failed bootstrap is retried by the next procedural
+    if (!_bootstrapped)
+    {
+        _bootstrapped = FnKat::RenderOutputUtils::bootstrapGEOLIB(katanaRoot);
+    }
+
+    return _bootstrapped;
+}
+
+FnKat::FnScenegraphIterator GeolibRuntime::getRootIterator(
+    const std::string& scriptPath)
+{
+    struct stat fileStat;
+    if (stat(scriptPath.c_str(), &fileStat) != 0)
+    {
+        return FnKat::FnScenegraphIterator();
+    }
+
+    UT_AutoLock lock(_lock);
+
+    // Render plug-ins rewrite the same script path for every frame, the
+    // modification time and size tell the versions apart.
+    auto it = _scripts.find(scriptPath);
+    if (it != _scripts.end()
+        && it->second.mtimeSec == fileStat.st_mtim.tv_sec
+        && it->second.mtimeNsec == fileStat.st_mtim.tv_nsec
+        && it->second.size == fileStat.st_size)
+    {
+        return getThreadRoot(it->second);
+    }
+
+    FnKat::FnScenegraphIterator rootIterator =
+        FnKat::RenderOutputUtils::readScript(scriptPath);
+
+    // Unreadable scripts are parsed again on the next request
+    if (!rootIterator.isValid())
+    {
+        _scripts.erase(scriptPath);
+        return rootIterator;
+    }
+
+    Script& script = _scripts[scriptPath];
+    script.mtimeSec = fileStat.st_mtim.tv_sec;
+    script.mtimeNsec = fileStat.st_mtim.tv_nsec;
+    script.size = fileStat.st_size;
+    script.rootIterator = rootIterator;
+    script.rootThread = std::this_thread::get_id();
+    script.opTree = rootIterator.getOpTree();
+    script.runtime.reset();
+    script.threadClients.clear();
+
+    return rootIterator;
+}
+
+FnKat::FnScenegraphIterator GeolibRuntime::getThreadIterator(
+    const std::string& scriptPath, const std::string& locationPath)
+{
+    FnKat::FnScenegraphIterator rootIterator;
+    {
+        UT_AutoLock lock(_lock);
+
+        auto it = _scripts.find(scriptPath);
+        if (it == _scripts.end())
+        {
+            return FnKat::FnScenegraphIterator();
+        }
+        rootIterator = getThreadRoot(it->second);
+    }
+
+    if (!rootIterator.isValid())
+    {
+        return rootIterator;
+    }
+
+    return locationPath == rootIterator.getFullName()
+        ? rootIterator : rootIterator.getByPath(locationPath);
+}
+
+FnKat::FnScenegraphIterator GeolibRuntime::getThreadRoot(Script& script)
+{
+    // Called with the lock held, so clients are created one at a time
+    const std::thread::id thread = std::this_thread::get_id();
+    if (thread == script.rootThread)
+    {
+        return script.rootIterator;
+    }
+
+    auto it = script.threadClients.find(thread);
+    if (it != script.threadClients.end())
+    {
+        return it->second.rootIterator;
+    }
+
+    // The op tree is only loaded once, on the runtime shared by the
+    // threads
+    if (!script.runtime)
+    {
+        script.runtime = FnKat::GeolibRuntime::create();
+        FnKat::GeolibRuntime::Transaction txn =
+            script.runtime->createTransaction();
+        script.op = txn.createOp();
+        txn.parseGraph(script.op, script.opTree);
+        script.runtime->commit(txn);
+    }
+
+    ThreadClient threadClient;
+    FnKat::GeolibRuntime::Transaction txn =
+        script.runtime->createTransaction();
+    threadClient.client = txn.createClient();
+    txn.setClientOp(threadClient.client, script.op);
+    script.runtime->commit(txn);
+
+    threadClient.rootIterator = threadClient.client.getRootIterator();
+    if (threadClient.rootIterator.isValid())
+    {
+        script.threadClients[thread] = threadClient;
+    }
+
+    return threadClient.rootIterator;
+}
+
+} // namespace ds_mfk
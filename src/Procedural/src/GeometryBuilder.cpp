@@ -0,0 +1,611 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+#include <GA/GA_BezBasis.h>
+#include <GA/GA_Handle.h>
+#include <GA/GA_NUBBasis.h>
+#include <GA/GA_Range.h>
+#include <GEO/GEO_Curve.h>
+#include <GEO/GEO_PolyCounts.h>
+#include <GU/GU_PackedGeometry.h>
+#include <GU/GU_PrimPoly.h>
+#include <UT/UT_ParallelUtil.h>
+
+#include "GeometryBuilder.h"
+
+namespace ds_mfk {
+
+GA_Offset appendPointBlock(GU_Detail* gdp,
+                           const FnKat::FloatConstVector& positions)
+{
+    const GA_Size numPoints = positions.size() / 3;
+    const GA_Offset startOff = gdp->appendPointBlock(numPoints);
+
+    setPointBlockPositions(gdp, startOff, positions);
+
+    return startOff;
+}
+
+void setPointBlockPositions(GU_Detail* gdp, GA_Offset startOff,
+                            const FnKat::FloatConstVector& positions)
+{
+    setPointBlockVectors(gdp, gdp->getP(), startOff, positions);
+}
+
+void setPointBlockVectors(GU_Detail* gdp, GA_Attribute* attrib,
+                          GA_Offset startOff,
+                          const FnKat::FloatConstVector& values)
+{
+    const GA_Size numPoints = values.size() / 3;
+    if (numPoints == 0)
+    {
+        return;
+    }
+
+    // Katana stores vectors as a flat array of float triplets, which matches
+    // the memory layout of UT_Vector3F.
+    const UT_Vector3F* src =
+        reinterpret_cast<const UT_Vector3F*>(values.data());
+
+    GA_RWHandleV3 handle(attrib);
+    const GA_Range range(gdp->getPointMap(), startOff, startOff + numPoints);
+
+    // The splittable range is partitioned on page boundaries, so each task
+    // copies whole pages with no contention on the underlying storage.
+    UTparallelForLightItems(GA_SplittableRange(range),
+        [&](const GA_SplittableRange& subRange)
+        {
+            GA_Offset start;
+            GA_Offset end;
+            for (GA_Iterator it(subRange); it.blockAdvance(start, end);)
+            {
+                handle.setBlock(start, end - start, src + (start - startOff));
+            }
+        });
+}
+
+void setPointBlockFloats(GU_Detail* gdp, GA_Attribute* attrib,
+                         GA_Offset startOff,
+                         const FnKat::FloatConstVector& values)
+{
+    const GA_Size numPoints = values.size();
+    if (numPoints == 0)
+    {
+        return;
+    }
+
+    GA_RWHandleF handle(attrib);
+    const GA_Range range(gdp->getPointMap(), startOff, startOff + numPoints);
+
+    UTparallelForLightItems(GA_SplittableRange(range),
+        [&](const GA_SplittableRange& subRange)
+        {
+            GA_Offset start;
+            GA_Offset end;
+            for (GA_Iterator it(subRange); it.blockAdvance(start, end);)
+            {
+                handle.setBlock(start, end - start,
+                                values.data() + (start - startOff));
+            }
+        });
+}
+
+void enlargePointBounds(UT_BoundingBox& bbox,
+                        const FnKat::FloatConstVector& positions)
+{
+    const size_t numValues = positions.size() - positions.size() % 3;
+    if (numValues == 0)
+    {
+        return;
+    }
+
+    // Independent accumulators over the raw float triplets, with no branch,
+    // so that the compiler can vectorize the loop.
+    const float* p = positions.data();
+    float minX = p[0], minY = p[1], minZ = p[2];
+    float maxX = p[0], maxY = p[1], maxZ = p[2];
+    for (size_t i = 3; i < numValues; i += 3)
+    {
+        minX = std::min(minX, p[i]);
+        minY = std::min(minY, p[i + 1]);
+        minZ = std::min(minZ, p[i + 2]);
+        maxX = std::max(maxX, p[i]);
+        maxY = std::max(maxY, p[i + 1]);
+        maxZ = std::max(maxZ, p[i + 2]);
+    }
+
+    bbox.enlargeBounds(UT_BoundingBox(minX, minY, minZ, maxX, maxY, maxZ));
+}
+
+GA_Offset buildPolygonBlock(GU_Detail* gdp, GA_Offset startPtOff,
+                            GA_Size numPoints,
+                            const FnKat::IntConstVector& startIndex,
+                            const FnKat::IntConstVector& vertexList,
+                            bool closed)
+{
+    const GA_Size numFaces = startIndex.size();
+    const GA_Size numVertices = vertexList.size();
+    if (numFaces == 0 || startIndex[0] != 0)
+    {
+        return GA_INVALID_OFFSET;
+    }
+
+    // Vertices are consumed in order, so faces with no vertices can simply be
+    // left out of the counts. This also drops the trailing entry Katana adds
+    // to 'startIndex' to mark the end of the vertex list.
+    GEO_PolyCounts polyCounts;
+    for (GA_Size i = 0; i < numFaces; ++i)
+    {
+        const GA_Size end =
+            (i + 1 < numFaces) ? startIndex[i + 1] : numVertices;
+        const GA_Size count = end - startIndex[i];
+
+        if (count < 0 || end > numVertices)
+        {
+            return GA_INVALID_OFFSET;
+        }
+
+        if (count > 0)
+        {
+            polyCounts.append(count);
+        }
+    }
+
+    const int* pointNumbers = vertexList.data();
+    for (GA_Size i = 0; i < numVertices; ++i)
+    {
+        if (pointNumbers[i] < 0 || pointNumbers[i] >= numPoints)
+        {
+            return GA_INVALID_OFFSET;
+        }
+    }
+
+    // Point numbers are read straight from the Katana vertex list.
+    return GU_PrimPoly::buildBlock(gdp, startPtOff, numPoints, polyCounts,
+                                   pointNumbers, closed);
+}
+
+GA_Offset buildCurveBlock(GU_Detail* gdp, GA_Offset startPtOff,
+                          GA_Size numPoints,
+                          const FnKat::IntConstVector& numVertices)
+{
+    // Grooms mostly hold curves with the same number of vertices, which the
+    // poly counts store as a handful of runs.
+    GEO_PolyCounts polyCounts;
+    GA_Size numCurveVertices = 0;
+    for (size_t i = 0; i < numVertices.size(); ++i)
+    {
+        if (numVertices[i] <= 0)
+        {
+            return GA_INVALID_OFFSET;
+        }
+
+        polyCounts.append(numVertices[i]);
+        numCurveVertices += numVertices[i];
+    }
+
+    if (numCurveVertices == 0 || numCurveVertices != numPoints)
+    {
+        return GA_INVALID_OFFSET;
+    }
+
+    GA_Offset startVtxOff;
+    const GA_Offset startPrimOff = gdp->appendPrimitivesAndVertices(
+        GA_PRIMPOLY, polyCounts, startVtxOff, false);
+
+    // Every point is used by a single curve, in order
+    GA_Topology& topology = gdp->getTopology();
+    for (GA_Size i = 0; i < numPoints; ++i)
+    {
+        topology.wireVertexPoint(startVtxOff + i, startPtOff + i);
+    }
+
+    return startPrimOff;
+}
+
+GA_Offset buildSplineCurves(GU_Detail* gdp, GA_Offset startPtOff,
+                            GA_Size numPoints,
+                            const FnKat::IntConstVector& numVertices,
+                            int degree, bool bezier)
+{
+    if (degree < 1)
+    {
+        return GA_INVALID_OFFSET;
+    }
+
+    GEO_PolyCounts polyCounts;
+    GA_Size numCurveVertices = 0;
+    for (size_t i = 0; i < numVertices.size(); ++i)
+    {
+        const bool valid = bezier
+            ? numVertices[i] > degree && (numVertices[i] - 1) % degree == 0
+            : numVertices[i] > degree;
+        if (!valid)
+        {
+            return GA_INVALID_OFFSET;
+        }
+
+        polyCounts.append(numVertices[i]);
+        numCurveVertices += numVertices[i];
+    }
+
+    if (numCurveVertices == 0 || numCurveVertices != numPoints)
+    {
+        return GA_INVALID_OFFSET;
+    }
+
+    // Same block layout as buildCurveBlock(), every point is used by a
+    // single curve, in order.
+    GA_Offset startVtxOff;
+    const GA_Offset startPrimOff = gdp->appendPrimitivesAndVertices(
+        bezier ? GA_PRIMBEZCURVE : GA_PRIMNURBCURVE, polyCounts, startVtxOff,
+        false);
+
+    GA_Topology& topology = gdp->getTopology();
+    for (GA_Size i = 0; i < numPoints; ++i)
+    {
+        topology.wireVertexPoint(startVtxOff + i, startPtOff + i);
+    }
+
+    // Each curve owns its basis, sized after its vertex count. Uniform
+    // B-splines do not interpolate their end points.
+    const int order = degree + 1;
+    UTparallelForLightItems(UT_BlockedRange<size_t>(0, numVertices.size()),
+        [&](const UT_BlockedRange<size_t>& range)
+        {
+            for (size_t i = range.begin(); i != range.end(); ++i)
+            {
+                GEO_Curve* curve = static_cast<GEO_Curve*>(
+                    gdp->getPrimitive(startPrimOff + i));
+                if (bezier)
+                {
+                    const int numSpans = (numVertices[i] - 1) / degree;
+                    curve->setBasis(new GA_BezBasis(order, numSpans + 1));
+                }
+                else
+                {
+                    curve->setBasis(new GA_NUBBasis(0.0, 1.0, numVertices[i],
+                                                    order, false));
+                }
+            }
+        });
+
+    return startPrimOff;
+}
+
+void setCreaseWeights(GU_Detail* gdp, GA_Offset startPrimOff,
+                      const FnKat::IntConstVector& startIndex,
+                      const FnKat::IntConstVector& vertexList,
+                      const FnKat::IntConstVector& creaseIndex,
+                      const FnKat::IntConstVector& creaseLengths,
+                      const FnKat::FloatConstVector& creaseSharpness)
+{
+    if (startPrimOff == GA_INVALID_OFFSET || creaseLengths.size() == 0)
+    {
+        return;
+    }
+
+    GA_Size numCreaseEdges = 0;
+    for (size_t i = 0; i < creaseLengths.size(); ++i)
+    {
+        numCreaseEdges += std::max(creaseLengths[i] - 1, 0);
+    }
+    const bool perEdgeSharpness =
+        static_cast<GA_Size>(creaseSharpness.size()) == numCreaseEdges;
+    if (!perEdgeSharpness && creaseSharpness.size() < creaseLengths.size())
+    {
+        return;
+    }
+
+    // Creases are given on point pairs, stored here regardless of their
+    // orientation to be matched against the polygon edges.
+    auto edgeKey = [](int a, int b)
+    {
+        return (static_cast<uint64_t>(std::min(a, b)) << 32)
+            | static_cast<uint32_t>(std::max(a, b));
+    };
+
+    std::unordered_map<uint64_t, float> creaseEdges;
+    size_t index = 0;
+    GA_Size edge = 0;
+    for (size_t i = 0; i < creaseLengths.size(); ++i)
+    {
+        const size_t end = index + creaseLengths[i];
+        if (end > creaseIndex.size())
+        {
+            return;
+        }
+
+        for (size_t j = index; j + 1 < end; ++j, ++edge)
+        {
+            creaseEdges[edgeKey(creaseIndex[j], creaseIndex[j + 1])] =
+                creaseSharpness[perEdgeSharpness ? edge : i];
+        }
+        index = end;
+    }
+
+    // buildPolygonBlock() allocates one vertex per 'vertexList' entry, in the
+    // same order, so weights are computed per entry and written as a block.
+    // The weight of a vertex applies to the edge going to the next vertex.
+    const GA_Size numFaces = startIndex.size();
+    const GA_Size numVertices = vertexList.size();
+    std::vector<float> weights(numVertices, 0.0f);
+    for (GA_Size i = 0; i < numFaces; ++i)
+    {
+        const GA_Size start = startIndex[i];
+        const GA_Size end =
+            (i + 1 < numFaces) ? startIndex[i + 1] : numVertices;
+        for (GA_Size j = start; j < end; ++j)
+        {
+            const GA_Size next = (j + 1 < end) ? j + 1 : start;
+            auto it =
+                creaseEdges.find(edgeKey(vertexList[j], vertexList[next]));
+            if (it != creaseEdges.end())
+            {
+                weights[j] = it->second;
+            }
+        }
+    }
+
+    GA_RWHandleF handle(
+        gdp->addFloatTuple(GA_ATTRIB_VERTEX, "creaseweight", 1));
+    const GA_Offset startVtxOff =
+        gdp->getPrimitive(startPrimOff)->getVertexOffset(0);
+    handle.setBlock(startVtxOff, numVertices, weights.data());
+}
+
+void setCornerWeights(GU_Detail* gdp, GA_Offset startPtOff, GA_Size numPoints,
+                      const FnKat::IntConstVector& cornerIndex,
+                      const FnKat::FloatConstVector& cornerSharpness)
+{
+    if (cornerIndex.size() == 0 || cornerSharpness.size() < cornerIndex.size())
+    {
+        return;
+    }
+
+    GA_RWHandleF handle(gdp->addFloatTuple(GA_ATTRIB_POINT, "cornerweight", 1));
+    for (size_t i = 0; i < cornerIndex.size(); ++i)
+    {
+        if (cornerIndex[i] >= 0 && cornerIndex[i] < numPoints)
+        {
+            handle.set(startPtOff + cornerIndex[i], cornerSharpness[i]);
+        }
+    }
+}
+
+void appendPackedInstances(GU_Detail* gdp, const GU_ConstDetailHandle& gdh,
+                           const UT_Matrix4D& xform, const double* matrices,
+                           const std::vector<int64_t>& instances)
+{
+    const GA_Size numInstances = instances.size();
+    if (numInstances == 0)
+    {
+        return;
+    }
+
+    // Primitives, vertices and points are all appended as blocks, each
+    // primitive with a single vertex on its own point.
+    GEO_PolyCounts vertexCounts;
+    vertexCounts.append(1, numInstances);
+    GA_Offset startVtxOff;
+    const GA_Offset startPrimOff = gdp->appendPrimitivesAndVertices(
+        GU_PackedGeometry::typeId(), vertexCounts, startVtxOff);
+    const GA_Offset startPtOff = gdp->appendPointBlock(numInstances);
+
+    GA_Topology& topology = gdp->getTopology();
+    for (GA_Size i = 0; i < numInstances; ++i)
+    {
+        topology.wireVertexPoint(startVtxOff + i, startPtOff + i);
+    }
+
+    // Each primitive owns its implementation and its transform, so they can
+    // be set concurrently. The positions are only gathered here.
+    std::vector<UT_Vector3F> positions(numInstances);
+    UTparallelForLightItems(UT_BlockedRange<GA_Size>(0, numInstances),
+        [&](const UT_BlockedRange<GA_Size>& range)
+        {
+            for (GA_Size i = range.begin(); i != range.end(); ++i)
+            {
+                GU_PrimPacked* prim = static_cast<GU_PrimPacked*>(
+                    gdp->getPrimitive(startPrimOff + i));
+                static_cast<GU_PackedGeometry*>(prim->implementation())
+                    ->setDetailPtr(gdh);
+
+                const double* m = matrices + 16 * instances[i];
+                const UT_Matrix4D instanceXform =
+                    xform * UT_Matrix4D((double(*)[4])m);
+
+                UT_Vector3D translate;
+                instanceXform.getTranslates(translate);
+
+                prim->setLocalTransform(UT_Matrix3D(instanceXform));
+                positions[i] = UT_Vector3F(translate);
+            }
+        });
+
+    // Positions are written by whole pages, as in setPointBlockVectors()
+    GA_RWHandleV3 handle(gdp->getP());
+    const GA_Range range(gdp->getPointMap(), startPtOff,
+                         startPtOff + numInstances);
+    UTparallelForLightItems(GA_SplittableRange(range),
+        [&](const GA_SplittableRange& subRange)
+        {
+            GA_Offset start;
+            GA_Offset end;
+            for (GA_Iterator it(subRange); it.blockAdvance(start, end);)
+            {
+                handle.setBlock(start, end - start,
+                                positions.data() + (start - startPtOff));
+            }
+        });
+}
+
+bool getInstanceMatrices(const FnKat::GroupAttribute& geometryAttr,
+                         std::vector<double>& matrices)
+{
+    FnKat::DoubleAttribute matrixAttr =
+        geometryAttr.getChildByName("instanceMatrix");
+    if (matrixAttr.isValid())
+    {
+        const FnKat::DoubleConstVector values =
+            matrixAttr.getNearestSample(0.0f);
+        matrices.assign(values.data(), values.data() + values.size());
+        return true;
+    }
+
+    FnKat::DoubleAttribute translateAttr =
+        geometryAttr.getChildByName("instanceTranslate");
+    FnKat::DoubleAttribute scaleAttr =
+        geometryAttr.getChildByName("instanceScale");
+    FnKat::DoubleAttribute rotateAttrs[3] = {
+        geometryAttr.getChildByName("instanceRotateX"),
+        geometryAttr.getChildByName("instanceRotateY"),
+        geometryAttr.getChildByName("instanceRotateZ") };
+
+    // Rotations hold an angle in degrees and its axis for each instance,
+    // or only the angle around the axis they are named after.
+    int64_t numInstances = -1;
+    if (translateAttr.isValid())
+    {
+        numInstances = translateAttr.getNumberOfValues() / 3;
+    }
+    else if (scaleAttr.isValid())
+    {
+        numInstances = scaleAttr.getNumberOfValues() / 3;
+    }
+    for (int axis = 0; axis < 3 && numInstances < 0; ++axis)
+    {
+        if (rotateAttrs[axis].isValid())
+        {
+            const int64_t tupleSize = rotateAttrs[axis].getTupleSize();
+            numInstances = rotateAttrs[axis].getNumberOfValues()
+                / (tupleSize == 4 ? 4 : 1);
+        }
+    }
+    if (numInstances < 0)
+    {
+        return false;
+    }
+
+    if ((translateAttr.isValid()
+         && translateAttr.getNumberOfValues() != numInstances * 3)
+        || (scaleAttr.isValid()
+            && scaleAttr.getNumberOfValues() != numInstances * 3))
+    {
+        return false;
+    }
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const FnKat::DoubleAttribute& rotateAttr = rotateAttrs[axis];
+        const int64_t tupleSize = rotateAttr.getTupleSize() == 4 ? 4 : 1;
+        if (rotateAttr.isValid()
+            && rotateAttr.getNumberOfValues() != numInstances * tupleSize)
+        {
+            return false;
+        }
+    }
+
+    const FnKat::DoubleConstVector translates =
+        translateAttr.getNearestSample(0.0f);
+    const FnKat::DoubleConstVector scales = scaleAttr.getNearestSample(0.0f);
+    const FnKat::DoubleConstVector rotates[3] = {
+        rotateAttrs[0].getNearestSample(0.0f),
+        rotateAttrs[1].getNearestSample(0.0f),
+        rotateAttrs[2].getNearestSample(0.0f) };
+
+    // Same order as the Katana transforms: scale, rotations around X, Y and
+    // Z, then translate.
+    matrices.resize(16 * numInstances);
+    UTparallelForLightItems(UT_BlockedRange<int64_t>(0, numInstances),
+        [&](const UT_BlockedRange<int64_t>& range)
+        {
+            for (int64_t i = range.begin(); i != range.end(); ++i)
+            {
+                UT_Matrix4D xform(1.0);
+                if (scaleAttr.isValid())
+                {
+                    xform.scale(scales[3 * i], scales[3 * i + 1],
+                                scales[3 * i + 2]);
+                }
+
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    if (!rotateAttrs[axis].isValid())
+                    {
+                        continue;
+                    }
+
+                    double angle;
+                    UT_Vector3D rotateAxis(axis == 0, axis == 1, axis == 2);
+                    if (rotateAttrs[axis].getTupleSize() == 4)
+                    {
+                        const double* r = rotates[axis].data() + 4 * i;
+                        angle = r[0];
+                        rotateAxis = UT_Vector3D(r[1], r[2], r[3]);
+                    }
+                    else
+                    {
+                        angle = rotates[axis][i];
+                    }
+                    xform.rotate(rotateAxis, angle * M_PI / 180.0);
+                }
+
+                if (translateAttr.isValid())
+                {
+                    xform.translate(translates[3 * i], translates[3 * i + 1],
+                                    translates[3 * i + 2]);
+                }
+
+                std::copy(xform.data(), xform.data() + 16,
+                          matrices.begin() + 16 * i);
+            }
+        });
+
+    return true;
+}
+
+} // namespace ds_mfk
@@ -41,9 +41,12 @@
 //
 // *****************************************************************************
 
+#include <algorithm>
+#include <thread>
+
 #include <GU/GU_Detail.h>
-#include <RenderOutputUtils/RenderOutputUtils.h>
 
+#include "GeolibRuntime.h"
 #include "ProceduralIterator.h"
 #include "KatanaProcedural.h"
 
@@ -52,6 +55,28 @@ namespace  ds_mfk {
 const VRAY_ProceduralArg g_proceduralArgs[] =
 {
     VRAY_ProceduralArg("producerFilename", "string", ""),
+    VRAY_ProceduralArg("deferredExpansion", "int", "1"),
+    VRAY_ProceduralArg("parallelTranslation", "int", "1"),
+    VRAY_ProceduralArg("deduplicateGeometry", "int", "1"),
+    VRAY_ProceduralArg("shutterOpen", "real", "0"),
+    VRAY_ProceduralArg("shutterClose", "real", "0"),
+    VRAY_ProceduralArg("motionSamples", "int", "1"),
+    VRAY_ProceduralArg("fps", "real", "24"),
+    VRAY_ProceduralArg("geometryCacheDir", "string", ""),
+    VRAY_ProceduralArg("geometryBudget", "real", "0"),
+    VRAY_ProceduralArg("renderPointsAs", "int", "0"),
+    VRAY_ProceduralArg("statsFile", "string", ""),
+    VRAY_ProceduralArg("frustumCulling", "int", "0"),
+    VRAY_ProceduralArg("cullingMargin", "real", "0"),
+    VRAY_ProceduralArg("cameraFov", "real", "70"),
+    VRAY_ProceduralArg("cameraResolution", "int", "0 0"),
+    VRAY_ProceduralArg("cameraClip", "real", "0.1 100000"),
+    VRAY_ProceduralArg("cameraXformOpen", "real",
+                       "1 0 0 0 0 1 0 0 0 0 1 0 0 0 0 1"),
+    VRAY_ProceduralArg("cameraXformClose", "real",
+                       "1 0 0 0 0 1 0 0 0 0 1 0 0 0 0 1"),
+    VRAY_ProceduralArg("lodLevel", "int", "-1"),
+    VRAY_ProceduralArg("meshChunkFaces", "int", "0"),
     VRAY_ProceduralArg()
 };
 
@@ -79,6 +104,106 @@ int KatanaProcedural::initialize(const UT_BoundingBox* bbox)
         return 0;
     }
 
+    ProceduralSettings settings;
+    settings.scriptPath = _producerFilepath;
+
+    int deferredExpansion = 1;
+    import("deferredExpansion", &deferredExpansion, 1);
+    settings.deferredExpansion = (deferredExpansion != 0);
+
+    int parallelTranslation = 1;
+    import("parallelTranslation", &parallelTranslation, 1);
+    settings.parallelTranslation = (parallelTranslation != 0);
+
+    int deduplicateGeometry = 1;
+    import("deduplicateGeometry", &deduplicateGeometry, 1);
+    settings.deduplicateGeometry = (deduplicateGeometry != 0);
+
+    fpreal shutterOpen = 0.0;
+    fpreal shutterClose = 0.0;
+    int motionSamples = 1;
+    import("shutterOpen", &shutterOpen, 1);
+    import("shutterClose", &shutterClose, 1);
+    import("motionSamples", &motionSamples, 1);
+    settings.shutterOpen = shutterOpen;
+    settings.shutterClose = shutterClose;
+
+    fpreal fps = 24.0;
+    import("fps", &fps, 1);
+    if (fps > 0.0)
+    {
+        settings.framesPerSecond = fps;
+    }
+
+    UT_String geometryCacheDir;
+    import("geometryCacheDir", geometryCacheDir);
+    settings.geometryCacheDir = geometryCacheDir.toStdString();
+
+    // In megabytes, as the Mantra cache size
+    fpreal geometryBudget = 0.0;
+    import("geometryBudget", &geometryBudget, 1);
+    settings.geometryBudget =
+        static_cast<int64_t>(std::max(geometryBudget, 0.0) * 1024 * 1024);
+
+    int renderPointsAs = 0;
+    import("renderPointsAs", &renderPointsAs, 1);
+    settings.renderPointsAs = renderPointsAs;
+
+    UT_String statsFile;
+    import("statsFile", statsFile);
+    settings.statsFile = statsFile.toStdString();
+
+    // Camera transforms at shutter open and close, culling accounts for the
+    // volume swept in between.
+    int cameraResolution[2] = { 0, 0 };
+    import("cameraResolution", cameraResolution, 2);
+    if (cameraResolution[0] > 0 && cameraResolution[1] > 0)
+    {
+        fpreal cameraFov = 70.0;
+        fpreal cameraClip[2] = { 0.1, 100000.0 };
+        fpreal cameraXforms[32];
+        import("cameraFov", &cameraFov, 1);
+        import("cameraClip", cameraClip, 2);
+        import("cameraXformOpen", cameraXforms, 16);
+        import("cameraXformClose", cameraXforms + 16, 16);
+        settings.cameraFov = cameraFov;
+        settings.cameraResolution[0] = cameraResolution[0];
+        settings.cameraResolution[1] = cameraResolution[1];
+        settings.cameraClip[0] = cameraClip[0];
+        settings.cameraClip[1] = cameraClip[1];
+        settings.cameraXforms.assign(cameraXforms, cameraXforms + 32);
+    }
+
+    int frustumCulling = 0;
+    fpreal cullingMargin = 0.0;
+    import("frustumCulling", &frustumCulling, 1);
+    import("cullingMargin", &cullingMargin, 1);
+    settings.frustumCulling = (frustumCulling != 0);
+    settings.cullingMargin = std::max(cullingMargin, 0.0);
+
+    int lodLevel = -1;
+    import("lodLevel", &lodLevel, 1);
+    settings.lodLevel = lodLevel;
+
+    int meshChunkFaces = 0;
+    import("meshChunkFaces", &meshChunkFaces, 1);
+    settings.meshChunkFaces = std::max(meshChunkFaces, 0);
+
+    // Same sampling used by the render plug-in for the camera. Without
+    // motion blur everything is sampled at the frame time.
+    settings.sampleTimes.assign(1, 0.0f);
+    if (shutterClose > shutterOpen && motionSamples > 1)
+    {
+        settings.sampleTimes.clear();
+        for (int i = 0; i < motionSamples; ++i)
+        {
+            settings.sampleTimes.push_back(shutterOpen
+                + (shutterClose - shutterOpen) * i / (motionSamples - 1));
+        }
+    }
+
+    _context.reset(new ProceduralContext(settings));
+
     const char* katanaRoot = getenv("KATANA_ROOT");
     if (!katanaRoot)
     {
@@ -87,14 +212,17 @@ int KatanaProcedural::initialize(const UT_BoundingBox* bbox)
         return 0;
     }
 
-    if (!FnKat::RenderOutputUtils::bootstrapGEOLIB(katanaRoot))
+    // Shared by every main procedural of the session
+    GeolibRuntime& runtime = GeolibRuntime::getInstance();
+    if (!runtime.bootstrap(katanaRoot))
     {
         std::cerr << "Procedural initialization failed: "
                   << "Failed to bootstrap Geolib.\n";
         return 0;
     }
 
-    _rootIterator = FnKat::RenderOutputUtils::readScript(_producerFilepath);
+    _rootIterator = runtime.getRootIterator(_producerFilepath);
+    _rootThread = std::this_thread::get_id();
 
     if (!_rootIterator.isValid())
     {
@@ -106,16 +234,49 @@ int KatanaProcedural::initialize(const UT_BoundingBox* bbox)
     return 1;
 }
 
+FnKat::FnScenegraphIterator KatanaProcedural::getRootIterator() const
+{
+    // Mantra may call back from another thread than initialize(), which must
+    // then read the scenegraph through its own Geolib client
+    if (std::this_thread::get_id() == _rootThread)
+    {
+        return _rootIterator;
+    }
+
+    return GeolibRuntime::getInstance().getThreadIterator(_producerFilepath,
+                                                          "/root");
+}
+
 void KatanaProcedural::getBoundingBox(UT_BoundingBox& bbox)
 {
-    bbox.initMaxBounds();
+    FnKat::FnScenegraphIterator rootIterator = getRootIterator();
+    if (!rootIterator.isValid() || !_context)
+    {
+        bbox.initMaxBounds();
+        return;
+    }
+
+    // Same bound the root procedural will report: its 'bound' attribute, or
+    // max bounds rather than cooking the whole scene to measure it
+    ProceduralIterator rootProc(rootIterator, _context);
+    rootProc.getBoundingBox(bbox);
 }
 
 void KatanaProcedural::render()
 {
+    FnKat::FnScenegraphIterator rootIterator = getRootIterator();
+    if (!rootIterator.isValid())
+    {
+        std::cerr << "Procedural failed: "
+                  << "Invalid root iterator\n";
+        return;
+    }
+
+    _context->addProcedural();
     openProceduralObject();
 
-    ProceduralIterator* proc = new ProceduralIterator(_rootIterator);
+    ProceduralIterator* proc =
+        new ProceduralIterator(rootIterator, _context);
     addProcedural(proc);
 
     closeObject();
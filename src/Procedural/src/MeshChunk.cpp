@@ -0,0 +1,254 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#include <algorithm>
+#include <utility>
+
+#include "MeshChunk.h"
+
+namespace ds_mfk {
+
+namespace {
+
+struct FaceCenter
+{
+    GA_Size face;
+    float center[3];
+};
+
+MeshChunk buildChunk(std::vector<FaceCenter>::const_iterator begin,
+                     std::vector<FaceCenter>::const_iterator end,
+                     const FnKat::FloatConstVector& points,
+                     const FnKat::IntConstVector& startIndex,
+                     const FnKat::IntConstVector& vertexList)
+{
+    MeshChunk chunk;
+    for (auto it = begin; it != end; ++it)
+    {
+        chunk.faces.push_back(it->face);
+    }
+    std::sort(chunk.faces.begin(), chunk.faces.end());
+
+    chunk.bbox.initBounds();
+    for (size_t i = 0; i < chunk.faces.size(); ++i)
+    {
+        const GA_Size face = chunk.faces[i];
+        for (GA_Size j = startIndex[face]; j < startIndex[face + 1]; ++j)
+        {
+            const GA_Size point = vertexList[j];
+            chunk.bbox.enlargeBounds(points[point * 3], points[point * 3 + 1],
+                                     points[point * 3 + 2]);
+        }
+    }
+
+    return chunk;
+}
+
+} // namespace
+
+std::vector<MeshChunk> splitMesh(const FnKat::FloatConstVector& points,
+                                 const FnKat::IntConstVector& startIndex,
+                                 const FnKat::IntConstVector& vertexList,
+                                 GA_Size maxFaces)
+{
+    std::vector<MeshChunk> chunks;
+    if (startIndex.size() < 2 || maxFaces < 1)
+    {
+        return chunks;
+    }
+
+    const GA_Size numFaces = startIndex.size() - 1;
+    const GA_Size numPoints = points.size() / 3;
+    const GA_Size numVertices = vertexList.size();
+
+    // Invalid topologies are left to the regular conversion, which reports
+    // them.
+    std::vector<FaceCenter> centers;
+    centers.reserve(numFaces);
+    for (GA_Size i = 0; i < numFaces; ++i)
+    {
+        const GA_Size start = startIndex[i];
+        const GA_Size end = startIndex[i + 1];
+        if (start < 0 || end < start || end > numVertices)
+        {
+            return chunks;
+        }
+
+        if (end == start)
+        {
+            continue;
+        }
+
+        FaceCenter center = { i, { 0.0f, 0.0f, 0.0f } };
+        for (GA_Size j = start; j < end; ++j)
+        {
+            const GA_Size point = vertexList[j];
+            if (point < 0 || point >= numPoints)
+            {
+                return chunks;
+            }
+
+            for (int c = 0; c < 3; ++c)
+            {
+                center.center[c] += points[point * 3 + c];
+            }
+        }
+        for (int c = 0; c < 3; ++c)
+        {
+            center.center[c] /= (end - start);
+        }
+        centers.push_back(center);
+    }
+
+    // Ranges of 'centers' left to split
+    std::vector<std::pair<size_t, size_t> > ranges(
+        1, std::make_pair(size_t(0), centers.size()));
+    while (!ranges.empty())
+    {
+        const size_t begin = ranges.back().first;
+        const size_t end = ranges.back().second;
+        ranges.pop_back();
+
+        if (end == begin)
+        {
+            continue;
+        }
+
+        if (static_cast<GA_Size>(end - begin) <= maxFaces)
+        {
+            chunks.push_back(buildChunk(centers.begin() + begin,
+                                        centers.begin() + end,
+                                        points, startIndex, vertexList));
+            continue;
+        }
+
+        float minCenter[3] = { centers[begin].center[0],
+                               centers[begin].center[1],
+                               centers[begin].center[2] };
+        float maxCenter[3] = { minCenter[0], minCenter[1], minCenter[2] };
+        for (size_t i = begin + 1; i < end; ++i)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                minCenter[c] = std::min(minCenter[c], centers[i].center[c]);
+                maxCenter[c] = std::max(maxCenter[c], centers[i].center[c]);
+            }
+        }
+
+        int axis = 0;
+        for (int c = 1; c < 3; ++c)
+        {
+            if (maxCenter[c] - minCenter[c] > maxCenter[axis] - minCenter[axis])
+            {
+                axis = c;
+            }
+        }
+
+        const size_t middle = begin + (end - begin) / 2;
+        std::nth_element(centers.begin() + begin, centers.begin() + middle,
+                         centers.begin() + end,
+                         [axis](const FaceCenter& a, const FaceCenter& b)
+                         {
+                             return a.center[axis] < b.center[axis];
+                         });
+
+        ranges.push_back(std::make_pair(begin, middle));
+        ranges.push_back(std::make_pair(middle, end));
+    }
+
+    return chunks;
+}
+
+void extractMeshChunk(const MeshChunk& chunk,
+                      const FnKat::FloatConstVector& points,
+                      const FnKat::IntConstVector& startIndex,
+                      const FnKat::IntConstVector& vertexList,
+                      MeshChunkTopology& topology)
+{
+    topology = MeshChunkTopology();
+
+    // Faces are in increasing order, and so are their vertices
+    for (size_t i = 0; i < chunk.faces.size(); ++i)
+    {
+        const GA_Size face = chunk.faces[i];
+        for (GA_Size j = startIndex[face]; j < startIndex[face + 1]; ++j)
+        {
+            topology.vertices.push_back(j);
+            topology.points.push_back(vertexList[j]);
+        }
+    }
+
+    std::sort(topology.points.begin(), topology.points.end());
+    topology.points.erase(
+        std::unique(topology.points.begin(), topology.points.end()),
+        topology.points.end());
+
+    topology.positions.reserve(topology.points.size() * 3);
+    for (size_t i = 0; i < topology.points.size(); ++i)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            topology.positions.push_back(points[topology.points[i] * 3 + c]);
+        }
+    }
+
+    // Chunks are far smaller than the mesh, points are remapped by binary
+    // search rather than through a table covering the whole mesh.
+    topology.vertexList.reserve(topology.vertices.size());
+    topology.startIndex.reserve(chunk.faces.size() + 1);
+    for (size_t i = 0; i < chunk.faces.size(); ++i)
+    {
+        const GA_Size face = chunk.faces[i];
+        topology.startIndex.push_back(topology.vertexList.size());
+        for (GA_Size j = startIndex[face]; j < startIndex[face + 1]; ++j)
+        {
+            const auto it = std::lower_bound(topology.points.begin(),
+                                             topology.points.end(),
+                                             vertexList[j]);
+            topology.vertexList.push_back(it - topology.points.begin());
+        }
+    }
+    topology.startIndex.push_back(topology.vertexList.size());
+}
+
+} // namespace ds_mfk
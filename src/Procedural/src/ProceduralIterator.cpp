@@ -41,16 +41,35 @@
 //
 // *****************************************************************************
 
+#include <algorithm>
+#include <limits>
+#include <set>
 #include <sstream>
 
-#include <GU/GU_PrimPoly.h>
+#include <GU/GU_PackedDisk.h>
+#include <GU/GU_PackedGeometry.h>
 #include <GU/GU_PrimSphere.h>
+#include <UT/UT_ParallelUtil.h>
 #include <RenderOutputUtils/RenderOutputUtils.h>
 
+#include "AttributeTransfer.h"
+#include "GeolibRuntime.h"
+#include "GeometryBuilder.h"
 #include "ProceduralIterator.h"
 
 namespace ds_mfk {
 
+namespace {
+
+// Single identity sample, for locations with no world transform
+const std::vector<UT_Matrix4D>& getIdentityXforms()
+{
+    static const std::vector<UT_Matrix4D> identity(1, UT_Matrix4D(1.0));
+    return identity;
+}
+
+} // namespace
+
 const char* ProceduralIterator::getClassName()
 {
     return className();
@@ -68,304 +87,2030 @@ int ProceduralIterator::initialize(const UT_BoundingBox* bbox)
 
 void ProceduralIterator::getBoundingBox(UT_BoundingBox& bbox)
 {
-    bbox.initMaxBounds();
-
-    FnKat::DoubleAttribute boundAttr = _sgIterator.getAttribute("bound");
-    if (!boundAttr.isValid())
+    if (_meshChunk)
+    {
+        bbox = _meshChunk->bbox;
         return;
+    }
 
-    const FnKat::DoubleConstVector boundValues =
-        boundAttr.getNearestSample(0.0f);
-    if (6 == boundValues.size())
+    if (!getLocationBound(getThreadIterator(_sgIterator, _sgPath, _sgThread),
+                          bbox))
     {
-        bbox.setBounds(
-            boundValues[0], boundValues[2], boundValues[4],
-            boundValues[1], boundValues[3], boundValues[5]);
+        bbox.initMaxBounds();
     }
 }
 
 void ProceduralIterator::render()
 {
-    renderLocation(_sgIterator);
+    // Mantra may render on another thread than the one creating the
+    // procedural
+    _sgIterator = getThreadIterator(_sgIterator, _sgPath, _sgThread);
+    _sgThread = std::this_thread::get_id();
+
+    // Child procedurals are bound to a single location, its siblings are
+    // handled by the parent procedural.
+    TranslatedLocation location(_sgIterator);
+    processLocation(location);
+    renderLocation(location);
+
+    _context->finishProcedural();
+}
+
+FnKat::FnScenegraphIterator ProceduralIterator::getThreadIterator(
+    FnKat::FnScenegraphIterator iterator, const std::string& path,
+    std::thread::id thread) const
+{
+    if (thread == std::this_thread::get_id())
+    {
+        return iterator;
+    }
+
+    FnKat::FnScenegraphIterator threadIterator =
+        GeolibRuntime::getInstance().getThreadIterator(
+            _context->getSettings().scriptPath, path);
+    if (!threadIterator.isValid())
+    {
+        std::cerr << "Procedural failed: "
+                  << "Cannot read " << path << " on this thread\n";
+    }
+
+    return threadIterator;
 }
 
-void ProceduralIterator::renderLocation(FnKat::FnScenegraphIterator sgIterator)
+void ProceduralIterator::bindToThread(TranslatedLocation& location) const
 {
-    while (sgIterator.isValid())
+    if (location.thread == std::this_thread::get_id())
+    {
+        return;
+    }
+
+    location.iterator = getThreadIterator(location.iterator, location.path,
+                                          location.thread);
+    location.materialIterator = location.materialPath == location.path
+        ? location.iterator
+        : getThreadIterator(location.materialIterator,
+                            location.materialPath, location.thread);
+    if (!location.instancePath.empty())
     {
-        processLocation(sgIterator);
-        sgIterator = sgIterator.getNextSibling();
+        location.instanceIterator = getThreadIterator(
+            location.instanceIterator, location.instancePath,
+            location.thread);
     }
+    location.thread = std::this_thread::get_id();
 }
 
-void ProceduralIterator::processLocation(FnKat::FnScenegraphIterator sgIterator)
+void ProceduralIterator::processLocation(TranslatedLocation& location)
 {
+    FnKat::FnScenegraphIterator sgIterator = location.iterator;
     if (!sgIterator.isValid())
     {
         return;
     }
 
     const std::string& type = sgIterator.getType();
+    StatsTimer timer;
 
-    if (type == "group")
+    // Subdivision and point rendering are enabled on the object when the
+    // location is rendered, curves and points share the mesh caching and
+    // motion blur paths.
+    if (type == "polymesh" || type == "subdmesh" || type == "curves"
+        || type == "pointcloud")
     {
-        processTransform(sgIterator);
-        processGroup(sgIterator);
+        processMesh(location);
     }
-    // TODO: polymesh and subdmesh should be handled separately.
-    else if (type == "polymesh" || type == "subdmesh")
+    else if (type == "instance")
     {
-        GU_Detail* gdp = processPoly(sgIterator, 0x0);
-        openGeometryObject();
-            processTransform(sgIterator);
-            processMaterial(sgIterator);
-            addGeometry(gdp, 0);
-        closeObject();
+        processInstance(location);
+    }
+    else if (type == "instance array")
+    {
+        processInstanceArray(location);
+    }
+    else if (type == "instance source")
+    {
+        // Only rendered through the instances referencing it
     }
     else
     {
-        processGroup(sgIterator);
+        // Children are recorded on their own, groups only account for the
+        // time spent to cook them.
+        processGroup(location);
+        recordStats(location, type, 0.0);
+        return;
     }
+
+    recordStats(location, type, timer.lap());
 }
 
-void ProceduralIterator::processGroup(FnKat::FnScenegraphIterator sgIterator)
+void ProceduralIterator::recordStats(TranslatedLocation& location,
+                                     const std::string& type,
+                                     double convertTime)
 {
-    FnKat::FnScenegraphIterator childSgIterator = sgIterator.getFirstChild();
-    if (!childSgIterator.isValid())
+    TranslationStats& translationStats = _context->getTranslationStats();
+    if (!translationStats.isEnabled())
     {
         return;
     }
 
-    // TODO: code to enable creation of recursive procedurals
-    // DoubleAttribute boundAttr = childSgIterator.getAttribute("bound");
-    // if (boundAttr.isValid())
-    // {
-    //    openProceduralObject();
-    //        addProcedural(new ProceduralIterator(childSgIterator));
-    //    closeObject();
-    //    return;
-    //}
+    LocationStats& stats = location.stats;
+    stats.path = location.iterator.getFullName();
+    stats.type = type;
+    stats.convertTime = convertTime;
 
-    renderLocation(childSgIterator);
+    // Instances only own the packed primitives referencing their sources,
+    // the children of other locations are recorded on their own.
+    const bool isInstance = type == "instance" || type == "instance array";
+    for (size_t i = 0; i < location.children.size() && isInstance; ++i)
+    {
+        const TranslatedLocation& child = location.children[i];
+        for (size_t j = 0; j < child.geometry.size() && !child.deferred; ++j)
+        {
+            stats.addGeometry(*child.geometry[j].second);
+        }
+    }
+
+    translationStats.record(stats);
 }
 
-GU_Detail* ProceduralIterator::processPoly(
-    FnKat::FnScenegraphIterator iterator, void* optionalInput)
+void ProceduralIterator::processGroup(TranslatedLocation& location)
 {
-    if (!iterator.isValid())
+    // Geolib cooks each location when the iterator reaches it
+    StatsTimer timer;
+    FnKat::FnScenegraphIterator childSgIterator =
+        location.iterator.getFirstChild();
+    while (childSgIterator.isValid())
     {
-        std::cerr << "Procedural failed: invalid iterator\n";
-        return nullptr;
+        // Hidden subtrees are dropped before their children are cooked
+        if (isLocationRendered(childSgIterator))
+        {
+            location.children.push_back(TranslatedLocation(childSgIterator));
+            location.children.back().stats.cookTime = timer.lap();
+        }
+        else
+        {
+            timer.lap();
+        }
+        childSgIterator = childSgIterator.getNextSibling();
     }
 
-    FnKat::GroupAttribute geometryGroupAttr = iterator.getAttribute("geometry");
-    if (!geometryGroupAttr.isValid())
+    if (location.iterator.getType() == "level-of-detail group")
     {
-        std::cerr << "Procedural failed: 'geometry' group not found\n";
-        return nullptr;
+        selectLevelOfDetail(location);
     }
 
-    FnKat::GroupAttribute polyGroupAttr =
-        geometryGroupAttr.getChildByName("poly");
-    FnKat::GroupAttribute pointGroupAttr =
-        geometryGroupAttr.getChildByName("point");
-    FnKat::GroupAttribute vertexGroupAttr =
-        geometryGroupAttr.getChildByName("vertex");
+    // Children with a valid bound become procedurals on their own, Mantra
+    // will only cook and convert them when a ray reaches their bounding box.
+    // Children entirely outside the camera view are left empty.
+    const ProceduralSettings& settings = _context->getSettings();
+    const CameraFrustum& frustum = _context->getCameraFrustum();
+    auto processChild = [&](TranslatedLocation& child)
+    {
+        // Children picked up by worker threads
+        bindToThread(child);
 
-    if (!polyGroupAttr.isValid() || !pointGroupAttr.isValid())
+        UT_BoundingBox childBBox;
+        const bool hasBound = (settings.deferredExpansion
+            || frustum.isEnabled())
+            && getLocationBound(child.iterator, childBBox);
+        if (hasBound && frustum.isOutside(childBBox))
+        {
+            return;
+        }
+
+        if (settings.deferredExpansion && hasBound)
+        {
+            child.deferred = true;
+        }
+        else
+        {
+            processLocation(child);
+        }
+    };
+
+    std::vector<TranslatedLocation>& children = location.children;
+    if (settings.parallelTranslation && children.size() > 1)
     {
-        std::cerr << "Procedural failed: invalid geometry'\n";
-       return nullptr;
+        // Nested groups spawn their own tasks, which are balanced across
+        // threads by work stealing.
+        UTparallelForHeavyItems(UT_BlockedRange<size_t>(0, children.size()),
+            [&](const UT_BlockedRange<size_t>& range)
+            {
+                for (size_t i = range.begin(); i != range.end(); ++i)
+                {
+                    processChild(children[i]);
+                }
+            });
     }
-
-    FnKat::FloatAttribute pointAttr = pointGroupAttr.getChildByName("P");
-    if (!pointAttr.isValid())
+    else
     {
-        std::cerr << "Procedural failed: invalid geometry'\n";
-        return nullptr;
+        for (size_t i = 0; i < children.size(); ++i)
+        {
+            processChild(children[i]);
+        }
     }
+}
 
-    FnKat::IntAttribute polyStartIndexAttr =
-        polyGroupAttr.getChildByName("startIndex");
-    FnKat::IntAttribute vertexListAttr =
-        polyGroupAttr.getChildByName("vertexList");
-    if (!polyStartIndexAttr.isValid() || !vertexListAttr.isValid())
+void ProceduralIterator::selectLevelOfDetail(
+    TranslatedLocation& location) const
+{
+    std::vector<TranslatedLocation>& children = location.children;
+    std::vector<size_t> levels;
+    for (size_t i = 0; i < children.size(); ++i)
     {
-        std::cerr << "Procedural failed: invalid geometry'\n";
-        return nullptr;
+        if (children[i].iterator.getType() == "level-of-detail")
+        {
+            levels.push_back(i);
+        }
     }
 
-    const int numPoly = polyStartIndexAttr.getNumberOfTuples();
-    const int numVert = vertexListAttr.getNumberOfTuples();
-    std::vector<int> vertCount(numPoly, 0);
-    std::vector<int> vertices(numVert, 0);
-
-    const FnKat::IntConstVector polyStartIndexAttrValue =
-        polyStartIndexAttr.getNearestSample(0.0f);
-    unsigned int srcIndex = 0;
+    if (levels.empty())
+    {
+        return;
+    }
 
-    int n_poly = numPoly;
-    for (size_t i = 0; srcIndex < numPoly; ++i, ++srcIndex)
+    // Without a camera, or a level matching the screen size, the highest
+    // detail is rendered.
+    const ProceduralSettings& settings = _context->getSettings();
+    const CameraFrustum& frustum = _context->getCameraFrustum();
+    int selected = 0;
+    if (settings.lodLevel >= 0)
     {
-        if (srcIndex + 1 < numPoly)
-        {
-            vertCount[i] = polyStartIndexAttrValue[srcIndex + 1] -
-                              polyStartIndexAttrValue[srcIndex];
-        }
-        else
+        selected = std::min(settings.lodLevel,
+                            static_cast<int>(levels.size()) - 1);
+    }
+    else if (frustum.hasCamera())
+    {
+        // The lowest detail is the cheapest to bound when the group has no
+        // 'bound' attribute.
+        UT_BoundingBox bbox;
+        const bool hasBound =
+            location.iterator.getAttribute("bound").isValid()
+            ? getLocationBound(location.iterator, bbox)
+            : getComputedBound(children[levels.back()].iterator, bbox)
+                && bbox.isValid();
+        if (hasBound)
         {
-            vertCount[i] = numVert - polyStartIndexAttrValue[srcIndex];
+            // Ranges are given in pixels of screen area, levels with no
+            // range are visible at any size.
+            const double area = frustum.getScreenArea(bbox);
+            for (size_t i = 0; i < levels.size(); ++i)
+            {
+                FnKat::GroupAttribute rangesAttr =
+                    children[levels[i]].iterator.getAttribute("lodRanges");
+                FnKat::FloatAttribute minVisibleAttr =
+                    rangesAttr.getChildByName("minVisible");
+                FnKat::FloatAttribute maxVisibleAttr =
+                    rangesAttr.getChildByName("maxVisible");
+                const double minVisible = minVisibleAttr.getValue(0.0f, false);
+                const double maxVisible = maxVisibleAttr.getValue(
+                    std::numeric_limits<float>::max(), false);
+                if (area >= minVisible && area < maxVisible)
+                {
+                    selected = static_cast<int>(i);
+                    break;
+                }
+            }
         }
+    }
 
-        if (vertCount[i] <= 0)
+    std::vector<TranslatedLocation> selectedChildren;
+    for (size_t i = 0, level = 0; i < children.size(); ++i)
+    {
+        if (level < levels.size() && levels[level] == i)
         {
-            --i;
-            --n_poly;
+            if (static_cast<int>(level++) != selected)
+            {
+                continue;
+            }
         }
+        selectedChildren.push_back(std::move(children[i]));
     }
+    children.swap(selectedChildren);
+}
 
-    FnKat::IntConstVector::const_iterator vertexIt =
-        vertexListAttr.getNearestSample(0).begin();
-    FnKat::IntConstVector::const_iterator vertexItEnd =
-        vertexListAttr.getNearestSample(0).end();
-    for (int i = 0; vertexIt != vertexItEnd; ++vertexIt, ++i)
+bool ProceduralIterator::isLocationRendered(
+    FnKat::FnScenegraphIterator iterator) const
+{
+    // Only checked on the location hiding the subtree, its descendants are
+    // never reached.
+    FnKat::IntAttribute visibleAttr = iterator.getAttribute("visible");
+    if (visibleAttr.isValid() && visibleAttr.getValue(1, false) == 0)
     {
-        vertices[i] = *vertexIt;
+        return false;
     }
 
-    // Allocate geometry for the procedural
-    GU_Detail* gdp = allocateGeometry();
+    FnKat::IntAttribute renderableAttr =
+        iterator.getAttribute("mantra13ObjectStatements.renderable");
+    if (renderableAttr.isValid() && renderableAttr.getValue(1, false) == 0)
+    {
+        return false;
+    }
 
-    const unsigned int numPoints = pointAttr.getNumberOfTuples();
-    FnKat::FloatConstVector vec = pointAttr.getNearestSample(0.0f);
-    const float* data = vec.data();
+    return true;
+}
 
-    for (unsigned int i = 0; i < numPoints; ++i)
+void ProceduralIterator::renderLocation(const TranslatedLocation& location)
+{
+    // Child procedurals look the location up on the thread rendering them
+    if (location.deferred)
     {
-        const float* curr = data;
+        _context->addProcedural();
+        openProceduralObject();
+            addProcedural(new ProceduralIterator(location.iterator,
+                location.path, location.thread, _context));
+        closeObject();
+        return;
+    }
 
-        GA_Offset ptoff = gdp->appendPointOffset();
-        gdp->setPos3(ptoff, *curr, *(curr + 1), *(curr + 2));
-        data += 3;
+    // Each chunk is only built when Mantra reaches its bound
+    if (!location.chunks.empty())
+    {
+        for (size_t i = 0; i < location.chunks.size(); ++i)
+        {
+            _context->addProcedural();
+            openProceduralObject();
+                addProcedural(new ProceduralIterator(location.iterator,
+                    location.path, location.thread, _context,
+                    location.chunks[i]));
+            closeObject();
+        }
+        return;
     }
 
-    int fInd = 0;
-    for (size_t i = 0; i < numPoly; ++i )
+    if (!location.geometry.empty())
     {
-        const int numPts = vertCount[i];
-        GU_PrimPoly* poly = GU_PrimPoly::build(gdp, numPts, GU_POLY_CLOSED, 0);
+        // Only objects read the location again, when translated by worker
+        // threads
+        FnKat::FnScenegraphIterator iterator = getThreadIterator(
+            location.iterator, location.path, location.thread);
+        FnKat::FnScenegraphIterator materialIterator =
+            location.materialPath == location.path
+            ? iterator
+            : getThreadIterator(location.materialIterator,
+                                location.materialPath, location.thread);
+        FnKat::FnScenegraphIterator instanceIterator =
+            location.instancePath.empty()
+            ? FnKat::FnScenegraphIterator()
+            : getThreadIterator(location.instanceIterator,
+                                location.instancePath, location.thread);
 
-        for (size_t j = 0; j < numPts; ++j)
+        int64_t bytes = 0;
+        for (size_t i = 0; i < location.geometry.size(); ++i)
         {
-            GA_Offset ptoff = vertices[fInd];
-            poly->setVertexPoint(j, ptoff);
-            ++fInd;
+            bytes += location.geometry[i].second->getMemoryUsage(true);
         }
+        _context->getResidencyManager().addLocation(bytes);
+
+        openGeometryObject();
+            if (!location.xforms.empty())
+            {
+                processTransform(location.xforms);
+            }
+            else
+            {
+                processTransform(iterator);
+            }
+            processMaterial(materialIterator);
+            // Settings authored on the instance win over the element ones
+            processRayVisibility(iterator);
+            if (instanceIterator.isValid())
+            {
+                processRayVisibility(instanceIterator);
+            }
+            const std::string type = iterator.getType();
+            if (type == "subdmesh")
+            {
+                // Mantra dices the cage on demand, based on its screen size
+                const int renderSubd = 1;
+                changeSetting("rendersubd", 1, &renderSubd, "object");
+            }
+            else if (type == "pointcloud")
+            {
+                const int renderPoints = 1;
+                const int renderPointsAs =
+                    _context->getSettings().renderPointsAs;
+                changeSetting("renderpoints", 1, &renderPoints, "object");
+                changeSetting("renderpointsas", 1, &renderPointsAs, "object");
+            }
+            if (location.velocityBlur)
+            {
+                const ProceduralSettings& settings = _context->getSettings();
+                addVelocityBlurGeometry(
+                    location.geometry[0].second,
+                    -settings.shutterOpen / settings.framesPerSecond,
+                    settings.shutterClose / settings.framesPerSecond);
+            }
+            else
+            {
+                for (size_t i = 0; i < location.geometry.size(); ++i)
+                {
+                    addGeometry(location.geometry[i].second,
+                                location.geometry[i].first);
+                }
+            }
+        closeObject();
+        return;
     }
 
-    return gdp;
+    for (size_t i = 0; i < location.children.size(); ++i)
+    {
+        renderLocation(location.children[i]);
+    }
 }
 
-void ProceduralIterator::processTransform(FnKat::FnScenegraphIterator iterator)
+void ProceduralIterator::processRayVisibility(
+    FnKat::FnScenegraphIterator iterator)
 {
-    FnKat::GroupAttribute xformAttr =
-        FnKat::RenderOutputUtils::getCollapsedXFormAttr(iterator);
-    if (!xformAttr.isValid())
+    // Inherited, usually set once on the asset or the matte group
+    FnKat::GroupAttribute objectAttr =
+        iterator.getAttribute("mantra13ObjectStatements", true);
+    if (!objectAttr.isValid())
     {
         return;
     }
 
-    bool isAbsolute;
-    std::vector<float> relevantSampleTimes;
-    relevantSampleTimes.push_back(0.0f);
-    FnKat::RenderOutputUtils::XFormMatrixVector xforms;
-    FnKat::RenderOutputUtils::calcXFormsFromAttr(
-        xforms, isAbsolute, xformAttr, relevantSampleTimes,
-        FnKat::RenderOutputUtils::kAttributeInterpolation_Linear);
+    // Ray types seeing the object, e.g. "primary" for camera only or
+    // "shadow" for shadow only
+    FnKat::StringAttribute visibilityAttr =
+        objectAttr.getChildByName("rendervisibility");
+    if (visibilityAttr.isValid())
+    {
+        const std::string visibility = visibilityAttr.getValue("*", false);
+        changeSetting("rendervisibility", visibility.c_str(), "object");
+    }
+
+    // Holdouts: cut out of the image, still seen by the other objects
+    FnKat::IntAttribute matteAttr = objectAttr.getChildByName("matte");
+    if (matteAttr.isValid())
+    {
+        const int matte = matteAttr.getValue(0, false);
+        changeSetting("matte", 1, &matte, "object");
+    }
 
-    const double* m = xforms[0].getValues();
-    UT_Matrix4D mat((double(*)[4])m);
-    setPreTransform(mat, 0.0f);
+    // Hidden from the camera, still seen by secondary rays
+    FnKat::IntAttribute phantomAttr = objectAttr.getChildByName("phantom");
+    if (phantomAttr.isValid())
+    {
+        const int phantom = phantomAttr.getValue(0, false);
+        changeSetting("phantom", 1, &phantom, "object");
+    }
 }
 
-// TODO: Avoid code duplication! See RendererPlugin/src/MantraRendererPlugin.cpp
-template <typename T>
-std::string ProceduralIterator::buildPropertyString(T attr) const
+void ProceduralIterator::processMesh(TranslatedLocation& location)
 {
-    assert(attr.isValid());
+    FnKat::FnScenegraphIterator iterator = location.iterator;
+    const ProceduralSettings& settings = _context->getSettings();
 
-    std::ostringstream ss;
-    FnKat::ConstVector<typename T::value_type> vec =
-        attr.getNearestSample(0.0f);
+    FnKat::FloatAttribute pointAttr =
+        iterator.getAttribute("geometry.point.P");
+    const std::vector<float> sampleTimes = getGeometrySampleTimes(pointAttr);
 
-    for (size_t i = 0; i < vec.size(); ++i)
+    // Velocities are only used when P provides a single sample, as multiple
+    // position samples give a more accurate motion.
+    FnKat::FloatAttribute velocityAttr =
+        iterator.getAttribute("geometry.point.v");
+    const bool velocityBlur = sampleTimes.size() == 1
+        && settings.shutterClose > settings.shutterOpen
+        && velocityAttr.isValid()
+        && velocityAttr.getNumberOfValues() == pointAttr.getNumberOfValues();
+
+    // Large static meshes are split in chunks, each built by its own
+    // procedural. Chunks are never shared, as their geometry is partial.
+    if (sampleTimes.size() == 1 && !velocityBlur && !_meshChunk
+        && processMeshChunks(location))
     {
-        ss << " " << vec.at(i);
+        return;
     }
-    return ss.str();
-}
 
-void ProceduralIterator::processMaterial(FnKat::FnScenegraphIterator iterator)
-{
-    FnKat::GroupAttribute matAttr = iterator.getAttribute("material", true);
+    // Subdivision cages are never packed: Mantra only dices the polygons
+    // of the object itself, with their crease weights, as subdivision
+    // surfaces.
+    if (sampleTimes.size() == 1 && !velocityBlur && !_meshChunk
+        && settings.deduplicateGeometry && iterator.getType() != "subdmesh")
+    {
+        const std::string key = getGeometryKey(iterator);
+        GeometryCache& cache = _context->getGeometryCache();
+        ResidencyManager& residency = _context->getResidencyManager();
 
-    if (!matAttr.isValid())
+        // Meshes found on disk, and not already loaded, are only read when
+        // Mantra unpacks them. Past the memory budget, new meshes are written
+        // to disk first.
+        std::string diskPath;
+        if (!key.empty() && !cache.find(key).isValid())
+        {
+            if (_context->getDiskGeometryCache().contains(key))
+            {
+                diskPath = _context->getDiskGeometryCache().getPath(key);
+            }
+            else if (residency.isOverBudget() && spillMesh(iterator, key))
+            {
+                diskPath = residency.getSpillPath(key);
+            }
+        }
+
+        if (!diskPath.empty())
+        {
+            GU_Detail* gdp = allocateLocationGeometry();
+            GU_PackedDisk::packedDisk(*gdp, diskPath);
+
+            location.geometry.push_back(std::make_pair(0.0, gdp));
+            return;
+        }
+
+        bool converted = false;
+        GU_ConstDetailHandle gdh = processSharedMesh(iterator, &converted);
+        if (!gdh.isValid())
+        {
+            return;
+        }
+
+        // Cached meshes are referenced by the objects already emitted, so
+        // they stay resident until the end of the render.
+        residency.addMesh(key, gdh.gdp()->getMemoryUsage(true));
+
+        // Each location gets a packed primitive instancing the shared mesh
+        GU_Detail* gdp = allocateLocationGeometry();
+        GU_PackedGeometry::packGeometry(*gdp, gdh);
+
+        // The shared mesh is accounted to the location converting it
+        if (converted)
+        {
+            location.stats.addGeometry(*gdh.gdp());
+        }
+        location.stats.addGeometry(*gdp);
+        location.geometry.push_back(std::make_pair(0.0, gdp));
+        return;
+    }
+
+    GU_Detail* gdp = allocateLocationGeometry();
+    if (!processGeometry(iterator, gdp, sampleTimes[0]))
     {
+        freeLocationGeometry(gdp);
         return;
     }
 
-    FnKat::StringAttribute matNameAttr = matAttr.getChildByName(
-        "mantra13SurfaceShader");
-    const std::string matName = matNameAttr.getValue("", false);
+    if (velocityBlur)
+    {
+        GA_Attribute* velocity =
+            gdp->addFloatTuple(GA_ATTRIB_POINT, "v", 3);
+        velocity->setTypeInfo(GA_TYPE_VECTOR);
+        setPointBlockVectors(gdp, velocity, gdp->pointOffset(0),
+                             velocityAttr.getNearestSample(sampleTimes[0]));
+
+        location.velocityBlur = true;
+    }
+
+    location.stats.addGeometry(*gdp);
+
+    if (sampleTimes.size() == 1)
+    {
+        location.geometry.push_back(std::make_pair(0.0, gdp));
+        return;
+    }
+
+    location.geometry.push_back(
+        std::make_pair(settings.getShutterOffset(sampleTimes[0]), gdp));
 
-    if (!matName.empty())
+    // Deforming meshes: the following samples only rebuild the topology,
+    // the positions and the attributes varying over time, each evaluated at
+    // its own time.
+    for (size_t i = 1; i < sampleTimes.size(); ++i)
     {
-        std::ostringstream ss;
-        ss << "opdef:/Shop/" << matName;
+        const FnKat::FloatConstVector points =
+            pointAttr.getNearestSample(sampleTimes[i]);
+        if (static_cast<GA_Size>(points.size() / 3) != gdp->getNumPoints())
+        {
+            std::cerr << "Procedural warning: inconsistent point count at time "
+                      << sampleTimes[i] << " for '"
+                      << iterator.getFullName() << "'\n";
+            continue;
+        }
 
-        // Build the shader's parameters string
-        FnKat::GroupAttribute params = matAttr.getChildByName(
-            "mantra13SurfaceParams");
-        for (int i = 0; i < params.getNumberOfChildren(); ++i)
+        GU_Detail* sampleGdp = allocateLocationGeometry();
+        if (!processGeometry(iterator, sampleGdp, sampleTimes[i], true)
+            || sampleGdp->getNumPrimitives() != gdp->getNumPrimitives())
         {
-            const std::string attrName = params.getChildName(i);
-            FnKat::DataAttribute attr = params.getChildByIndex(i);
+            freeLocationGeometry(sampleGdp);
+            continue;
+        }
+        location.stats.bytes += sampleGdp->getMemoryUsage(true);
+
+        location.geometry.push_back(std::make_pair(
+            settings.getShutterOffset(sampleTimes[i]), sampleGdp));
+    }
+}
+
+bool ProceduralIterator::processMeshChunks(TranslatedLocation& location)
+{
+    FnKat::FnScenegraphIterator iterator = location.iterator;
+    const ProceduralSettings& settings = _context->getSettings();
+
+    // Subdivision surfaces would crack along the chunk borders
+    if (settings.meshChunkFaces <= 0 || iterator.getType() != "polymesh")
+    {
+        return false;
+    }
+
+    FnKat::IntAttribute polyStartIndexAttr =
+        iterator.getAttribute("geometry.poly.startIndex");
+    if (polyStartIndexAttr.getNumberOfValues() - 1 <= settings.meshChunkFaces)
+    {
+        return false;
+    }
+
+    FnKat::FloatAttribute pointAttr =
+        iterator.getAttribute("geometry.point.P");
+    FnKat::IntAttribute vertexListAttr =
+        iterator.getAttribute("geometry.poly.vertexList");
+    if (!pointAttr.isValid() || !vertexListAttr.isValid())
+    {
+        return false;
+    }
+
+    std::vector<MeshChunk> chunks = splitMesh(
+        pointAttr.getNearestSample(0.0f),
+        polyStartIndexAttr.getNearestSample(0.0f),
+        vertexListAttr.getNearestSample(0.0f), settings.meshChunkFaces);
+    if (chunks.size() < 2)
+    {
+        return false;
+    }
 
-            if (attr.isValid())
+    // Chunk procedurals live in world space, like all the others. Chunks out
+    // of the camera view are dropped as any other location.
+    const CameraFrustum& frustum = _context->getCameraFrustum();
+    const std::vector<UT_Matrix4D>& xforms = getWorldXforms(iterator);
+    for (size_t i = 0; i < chunks.size(); ++i)
+    {
+        MeshChunk& chunk = chunks[i];
+        if (!xforms.empty())
+        {
+            const UT_BoundingBox localBBox(chunk.bbox);
+            chunk.bbox.initBounds();
+            for (size_t j = 0; j < xforms.size(); ++j)
             {
-                std::string attrStr;
-                switch (attr.getType())
-                {
-                    case kFnKatAttributeTypeInt:
-                        attrStr =
-                            buildPropertyString<FnKat::IntAttribute>(attr);
-                        break;
-
-                    case kFnKatAttributeTypeFloat:
-                        attrStr =
-                            buildPropertyString<FnKat::FloatAttribute>(attr);
-                        break;
-
-                    case kFnKatAttributeTypeDouble:
-                        attrStr =
-                            buildPropertyString<FnKat::DoubleAttribute>(attr);
-                        break;
-
-                    case kFnKatAttributeTypeString:
-                        attrStr =
-                            buildPropertyString<FnKat::StringAttribute>(attr);
-                        break;
-
-                    default:
-                        std::cerr << "Warning: unknown attribute type for '"
-                                  << attrName << "'\n";
-                        continue;
-                }
-                ss << " " << attrName << " " << attrStr << "\n";
+                UT_BoundingBox sampleBBox(localBBox);
+                sampleBBox.transform(xforms[j]);
+                chunk.bbox.enlargeBounds(sampleBBox);
             }
         }
-        changeSetting("surface", ss.str().c_str(), "object");
+
+        if (!frustum.isOutside(chunk.bbox))
+        {
+            location.chunks.push_back(
+                MeshChunkPtr(new MeshChunk(std::move(chunk))));
+        }
+    }
+
+    return true;
+}
+
+std::string ProceduralIterator::getGeometryKey(
+    FnKat::FnScenegraphIterator iterator) const
+{
+    FnKat::GroupAttribute geometryGroupAttr = iterator.getAttribute("geometry");
+    if (!geometryGroupAttr.isValid())
+    {
+        return std::string();
+    }
+
+    // Copies of the same asset carry byte-identical geometry attributes and
+    // only differ by transform and material, which are set on the object.
+    // Facesets are baked in the detail, along with their own materials.
+    std::string key =
+        iterator.getType() + ":" + geometryGroupAttr.getHash().str();
+    FnKat::FnScenegraphIterator childSgIterator = iterator.getFirstChild();
+    while (childSgIterator.isValid())
+    {
+        if (childSgIterator.getType() == "faceset")
+        {
+            FnKat::Attribute facesAttr =
+                childSgIterator.getAttribute("geometry.faces");
+            FnKat::Attribute matAttr = childSgIterator.getAttribute("material");
+            key += ":" + childSgIterator.getName() + ":"
+                + (facesAttr.isValid() ? facesAttr.getHash().str() : "")
+                + ":" + (matAttr.isValid() ? matAttr.getHash().str() : "");
+        }
+        childSgIterator = childSgIterator.getNextSibling();
+    }
+
+    return key;
+}
+
+bool ProceduralIterator::spillMesh(FnKat::FnScenegraphIterator iterator,
+                                   const std::string& key)
+{
+    ResidencyManager& residency = _context->getResidencyManager();
+    if (!residency.canSpill())
+    {
+        return false;
+    }
+
+    if (residency.isMeshSpilled(key))
+    {
+        return true;
+    }
+
+    GU_Detail meshGdp;
+    return processGeometry(iterator, &meshGdp)
+        && residency.spillMesh(key, meshGdp);
+}
+
+GU_ConstDetailHandle ProceduralIterator::processSharedMesh(
+    FnKat::FnScenegraphIterator iterator, bool* converted)
+{
+    if (converted)
+    {
+        *converted = false;
     }
+
+    const std::string key = getGeometryKey(iterator);
+    if (key.empty())
+    {
+        std::cerr << "Procedural failed: 'geometry' group not found\n";
+        return GU_ConstDetailHandle();
+    }
+
+    const bool useCache = _context->getSettings().deduplicateGeometry;
+
+    GeometryCache& cache = _context->getGeometryCache();
+    if (useCache)
+    {
+        GU_ConstDetailHandle gdh = cache.find(key);
+        if (gdh.isValid())
+        {
+            return gdh;
+        }
+    }
+
+    // Geometry converted by a previous render is loaded as it is, otherwise
+    // the conversion is stored for the next ones.
+    const DiskGeometryCache& diskCache = _context->getDiskGeometryCache();
+    GU_Detail* meshGdp = new GU_Detail();
+    if (!diskCache.contains(key) || !diskCache.load(key, meshGdp))
+    {
+        meshGdp->clearAndDestroy();
+        if (!processGeometry(iterator, meshGdp))
+        {
+            delete meshGdp;
+            return GU_ConstDetailHandle();
+        }
+
+        diskCache.save(key, *meshGdp);
+    }
+
+    GU_DetailHandle meshGdh;
+    meshGdh.allocateAndSet(meshGdp);
+
+    // Another thread may have stored the same mesh in the meantime
+    GU_ConstDetailHandle gdh = useCache ? cache.insert(key, meshGdh)
+                                        : GU_ConstDetailHandle(meshGdh);
+    if (converted)
+    {
+        *converted = gdh.gdp() == meshGdp;
+    }
+
+    return gdh;
+}
+
+void ProceduralIterator::processInstance(TranslatedLocation& location)
+{
+    FnKat::FnScenegraphIterator sgIterator = location.iterator;
+
+    FnKat::StringAttribute sourceAttr =
+        sgIterator.getAttribute("geometry.instanceSource");
+    const std::string sourcePath = sourceAttr.getValue("", false);
+    if (sourcePath.empty())
+    {
+        std::cerr << "Procedural failed: no instance source for '"
+                  << sgIterator.getFullName() << "'\n";
+        return;
+    }
+
+    InstanceSourcePtr source =
+        processInstanceSource(sgIterator.getByPath(sourcePath));
+    if (!source)
+    {
+        std::cerr << "Procedural failed: invalid instance source '"
+                  << sourcePath << "'\n";
+        return;
+    }
+
+    const std::vector<UT_Matrix4D>& worldXforms = getWorldXforms(sgIterator);
+    const std::vector<UT_Matrix4D>& instanceXforms =
+        worldXforms.empty() ? getIdentityXforms() : worldXforms;
+
+    // A material assigned to the instance overrides the source ones
+    FnKat::GroupAttribute matAttr = sgIterator.getAttribute("material");
+    const bool overrideMaterial = matAttr.isValid();
+
+    // The source geometry is never duplicated, every element gets a packed
+    // primitive referencing it, placed by the instance transform. Only
+    // subdivision cages are copied, so that Mantra dices them.
+    for (size_t i = 0; i < source->size(); ++i)
+    {
+        const InstanceSourceElement& element = (*source)[i];
+
+        TranslatedLocation child(getThreadIterator(
+            element.iterator, element.path, element.thread));
+        child.instanceIterator = sgIterator;
+        child.instancePath = location.path;
+        if (overrideMaterial)
+        {
+            child.materialIterator = sgIterator;
+            child.materialPath = location.path;
+        }
+
+        for (size_t j = 0; j < instanceXforms.size(); ++j)
+        {
+            child.xforms.push_back(element.xform * instanceXforms[j]);
+        }
+
+        GU_Detail* gdp = allocateLocationGeometry();
+        if (element.subdivision)
+        {
+            gdp->copy(*element.gdh.gdp());
+        }
+        else
+        {
+            GU_PackedGeometry::packGeometry(*gdp, element.gdh);
+        }
+        child.geometry.push_back(std::make_pair(0.0, gdp));
+
+        location.children.push_back(child);
+    }
+}
+
+void ProceduralIterator::processInstanceArray(TranslatedLocation& location)
+{
+    FnKat::FnScenegraphIterator sgIterator = location.iterator;
+
+    FnKat::StringAttribute sourcesAttr =
+        sgIterator.getAttribute("geometry.instanceSource");
+    if (!sourcesAttr.isValid())
+    {
+        std::cerr << "Procedural failed: invalid instance array '"
+                  << sgIterator.getFullName() << "'\n";
+        return;
+    }
+
+    // Instances are placed by matrices, or by separate transform components
+    std::vector<double> matrices;
+    if (!getInstanceMatrices(sgIterator.getAttribute("geometry"), matrices))
+    {
+        std::cerr << "Procedural warning: no valid instance transforms for '"
+                  << sgIterator.getFullName() << "', skipped\n";
+        return;
+    }
+    const int64_t numInstances = matrices.size() / 16;
+
+    // Without an index all the instances use the first source
+    FnKat::IntAttribute indexAttr =
+        sgIterator.getAttribute("geometry.instanceIndex");
+    const FnKat::IntConstVector indices = indexAttr.getNearestSample(0.0f);
+    const bool hasIndices = indexAttr.isValid();
+    if (hasIndices && static_cast<int64_t>(indices.size()) < numInstances)
+    {
+        std::cerr << "Procedural failed: invalid instance index for '"
+                  << sgIterator.getFullName() << "'\n";
+        return;
+    }
+
+    std::vector<bool> skipped(numInstances, false);
+    FnKat::IntAttribute skipAttr =
+        sgIterator.getAttribute("geometry.instanceSkipIndex");
+    if (skipAttr.isValid())
+    {
+        const FnKat::IntConstVector skipIndices =
+            skipAttr.getNearestSample(0.0f);
+        for (size_t i = 0; i < skipIndices.size(); ++i)
+        {
+            if (skipIndices[i] >= 0 && skipIndices[i] < numInstances)
+            {
+                skipped[skipIndices[i]] = true;
+            }
+        }
+    }
+
+    const std::vector<UT_Matrix4D>& worldXforms = getWorldXforms(sgIterator);
+    const std::vector<UT_Matrix4D>& arrayXforms =
+        worldXforms.empty() ? getIdentityXforms() : worldXforms;
+
+    FnKat::GroupAttribute matAttr = sgIterator.getAttribute("material");
+    const bool overrideMaterial = matAttr.isValid();
+
+    // All the instances of a source element are packed primitives in a single
+    // object, so only one object per element is created for the whole array.
+    const FnKat::StringConstVector sourcePaths =
+        sourcesAttr.getNearestSample(0.0f);
+
+    std::vector<std::vector<int64_t> > sourceInstances(sourcePaths.size());
+    for (int64_t i = 0; i < numInstances; ++i)
+    {
+        const int sourceIndex = hasIndices ? indices[i] : 0;
+        if (!skipped[i] && sourceIndex >= 0
+            && sourceIndex < static_cast<int>(sourcePaths.size()))
+        {
+            sourceInstances[sourceIndex].push_back(i);
+        }
+    }
+
+    for (size_t s = 0; s < sourcePaths.size(); ++s)
+    {
+        const std::vector<int64_t>& instances = sourceInstances[s];
+        if (instances.empty())
+        {
+            continue;
+        }
+
+        InstanceSourcePtr source =
+            processInstanceSource(sgIterator.getByPath(sourcePaths[s]));
+        if (!source)
+        {
+            std::cerr << "Procedural failed: invalid instance source '"
+                      << sourcePaths[s] << "'\n";
+            continue;
+        }
+
+        for (size_t i = 0; i < source->size(); ++i)
+        {
+            const InstanceSourceElement& element = (*source)[i];
+
+            TranslatedLocation child(getThreadIterator(
+                element.iterator, element.path, element.thread));
+            child.instanceIterator = sgIterator;
+            child.instancePath = location.path;
+            if (overrideMaterial)
+            {
+                child.materialIterator = sgIterator;
+                child.materialPath = location.path;
+            }
+
+            // Subdivision cages are copied in an object per instance
+            if (element.subdivision)
+            {
+                for (size_t j = 0; j < instances.size(); ++j)
+                {
+                    TranslatedLocation instance(child);
+                    const UT_Matrix4D instanceXform = element.xform
+                        * UT_Matrix4D((double(*)[4])(
+                              matrices.data() + 16 * instances[j]));
+                    for (size_t k = 0; k < arrayXforms.size(); ++k)
+                    {
+                        instance.xforms.push_back(
+                            instanceXform * arrayXforms[k]);
+                    }
+
+                    GU_Detail* gdp = allocateLocationGeometry();
+                    gdp->copy(*element.gdh.gdp());
+                    instance.geometry.push_back(std::make_pair(0.0, gdp));
+
+                    location.children.push_back(instance);
+                }
+                continue;
+            }
+
+            child.xforms = arrayXforms;
+
+            GU_Detail* gdp = allocateLocationGeometry();
+            appendPackedInstances(gdp, element.gdh, element.xform,
+                                  matrices.data(), instances);
+            child.geometry.push_back(std::make_pair(0.0, gdp));
+
+            location.children.push_back(child);
+        }
+    }
+}
+
+InstanceSourcePtr ProceduralIterator::processInstanceSource(
+    FnKat::FnScenegraphIterator iterator)
+{
+    if (!iterator.isValid())
+    {
+        return InstanceSourcePtr();
+    }
+
+    // Instance sources are translated once, by the first instance reaching
+    // them, and then shared by all the procedurals.
+    const std::string path = iterator.getFullName();
+
+    InstanceSourceCache& cache = _context->getInstanceSourceCache();
+    InstanceSourcePtr cachedSource = cache.find(path);
+    if (cachedSource)
+    {
+        return cachedSource;
+    }
+
+    // Instance sources are expected to be static, their shutter open
+    // transform is used to place their elements.
+    const std::vector<UT_Matrix4D>& sourceXforms = getWorldXforms(iterator);
+    UT_Matrix4D sourceXform(1.0);
+    if (!sourceXforms.empty())
+    {
+        sourceXform = sourceXforms[0];
+        sourceXform.invert();
+    }
+
+    std::shared_ptr<InstanceSource> source(new InstanceSource());
+    collectInstanceSourceElements(iterator, sourceXform, *source);
+
+    return cache.insert(path, source);
+}
+
+void ProceduralIterator::collectInstanceSourceElements(
+    FnKat::FnScenegraphIterator iterator, const UT_Matrix4D& sourceXform,
+    InstanceSource& source)
+{
+    const std::string type = iterator.getType();
+
+    if (type == "polymesh" || type == "subdmesh" || type == "curves"
+        || type == "pointcloud")
+    {
+        InstanceSourceElement element;
+        element.iterator = iterator;
+        element.path = iterator.getFullName();
+        element.thread = std::this_thread::get_id();
+        element.subdivision = type == "subdmesh";
+        if (element.subdivision)
+        {
+            // Converted once per instance source, outside of the shared
+            // meshes
+            GU_Detail* gdp = new GU_Detail();
+            if (!processGeometry(iterator, gdp))
+            {
+                delete gdp;
+                return;
+            }
+
+            GU_DetailHandle gdh;
+            gdh.allocateAndSet(gdp);
+            element.gdh = gdh;
+        }
+        else
+        {
+            element.gdh = processSharedMesh(iterator);
+        }
+
+        if (!element.gdh.isValid())
+        {
+            return;
+        }
+
+        // Transform relative to the instance source location
+        const std::vector<UT_Matrix4D>& elementXforms =
+            getWorldXforms(iterator);
+        element.xform = sourceXform;
+        if (!elementXforms.empty())
+        {
+            element.xform = elementXforms[0] * sourceXform;
+        }
+
+        source.push_back(element);
+        return;
+    }
+
+    FnKat::FnScenegraphIterator childSgIterator = iterator.getFirstChild();
+    while (childSgIterator.isValid())
+    {
+        if (isLocationRendered(childSgIterator))
+        {
+            collectInstanceSourceElements(childSgIterator, sourceXform,
+                                          source);
+        }
+        childSgIterator = childSgIterator.getNextSibling();
+    }
+}
+
+bool ProceduralIterator::processGeometry(
+    FnKat::FnScenegraphIterator iterator, GU_Detail* gdp, float sampleTime,
+    bool motionSample)
+{
+    const std::string type = iterator.isValid() ? iterator.getType() : "";
+    if (type == "curves")
+    {
+        return processCurves(iterator, gdp, sampleTime, motionSample);
+    }
+    if (type == "pointcloud")
+    {
+        return processPointCloud(iterator, gdp, sampleTime, motionSample);
+    }
+
+    return processPoly(iterator, gdp, sampleTime, motionSample);
+}
+
+bool ProceduralIterator::processCurves(
+    FnKat::FnScenegraphIterator iterator, GU_Detail* gdp, float sampleTime,
+    bool motionSample)
+{
+    FnKat::GroupAttribute geometryGroupAttr = iterator.getAttribute("geometry");
+    if (!geometryGroupAttr.isValid())
+    {
+        std::cerr << "Procedural failed: 'geometry' group not found\n";
+        return false;
+    }
+
+    FnKat::FloatAttribute pointAttr =
+        geometryGroupAttr.getChildByName("point.P");
+    FnKat::IntAttribute numVerticesAttr =
+        geometryGroupAttr.getChildByName("numVertices");
+    if (!pointAttr.isValid() || !numVerticesAttr.isValid())
+    {
+        std::cerr << "Procedural failed: invalid curves '"
+                  << iterator.getFullName() << "'\n";
+        return false;
+    }
+
+    const FnKat::FloatConstVector points =
+        pointAttr.getNearestSample(sampleTime);
+    const GA_Offset startPtOff = appendPointBlock(gdp, points);
+
+    // Bases follow the Alembic ones: 0 linear, 1 Bezier, 2 B-spline,
+    // 3 Catmull-Rom, 4 Hermite and 5 power. Cubic curves with no basis are
+    // B-splines.
+    FnKat::IntAttribute degreeAttr = geometryGroupAttr.getChildByName("degree");
+    FnKat::IntAttribute basisAttr = geometryGroupAttr.getChildByName("basis");
+    const int degree = degreeAttr.getValue(1, false);
+    const int basis = basisAttr.getValue(degree > 1 ? 2 : 0, false);
+
+    const FnKat::IntConstVector numVertices =
+        numVerticesAttr.getNearestSample(0.0f);
+    GA_Offset startPrimOff = GA_INVALID_OFFSET;
+    if (degree > 1 && (basis == 1 || basis == 2))
+    {
+        startPrimOff = buildSplineCurves(gdp, startPtOff, points.size() / 3,
+                                         numVertices, degree, basis == 1);
+        if (startPrimOff == GA_INVALID_OFFSET)
+        {
+            std::cerr << "Procedural warning: vertex counts not matching the "
+                      << "basis of '" << iterator.getFullName()
+                      << "', rendered as linear curves\n";
+        }
+    }
+    else if (degree > 1 && basis != 0)
+    {
+        std::cerr << "Procedural warning: unsupported basis for '"
+                  << iterator.getFullName() << "', rendered as linear "
+                  << "curves\n";
+    }
+
+    if (startPrimOff == GA_INVALID_OFFSET)
+    {
+        startPrimOff = buildCurveBlock(gdp, startPtOff, points.size() / 3,
+                                       numVertices);
+    }
+    if (startPrimOff == GA_INVALID_OFFSET)
+    {
+        std::cerr << "Procedural failed: invalid topology for '"
+                  << iterator.getFullName() << "'\n";
+        return false;
+    }
+
+    AttributeTarget target;
+    target.startPointOffset = startPtOff;
+    target.numPoints = points.size() / 3;
+    target.startPrimitiveOffset = startPrimOff;
+    target.numFaces = numVertices.size();
+    target.startVertexOffset =
+        gdp->getPrimitive(startPrimOff)->getVertexOffset(0);
+    target.numVertices = target.numPoints;
+    transferAttributes(gdp, geometryGroupAttr, target, sampleTime,
+                       motionSample);
+
+    processWidth(geometryGroupAttr, gdp, startPtOff, target.numPoints,
+                 sampleTime, motionSample);
+
+    return true;
+}
+
+bool ProceduralIterator::processPointCloud(
+    FnKat::FnScenegraphIterator iterator, GU_Detail* gdp, float sampleTime,
+    bool motionSample)
+{
+    FnKat::GroupAttribute geometryGroupAttr = iterator.getAttribute("geometry");
+    FnKat::FloatAttribute pointAttr =
+        geometryGroupAttr.getChildByName("point.P");
+    if (!pointAttr.isValid())
+    {
+        std::cerr << "Procedural failed: invalid pointcloud '"
+                  << iterator.getFullName() << "'\n";
+        return false;
+    }
+
+    // No primitive at all, the object is set to render its points
+    const FnKat::FloatConstVector points =
+        pointAttr.getNearestSample(sampleTime);
+    const GA_Offset startPtOff = appendPointBlock(gdp, points);
+
+    AttributeTarget target;
+    target.startPointOffset = startPtOff;
+    target.numPoints = points.size() / 3;
+    transferAttributes(gdp, geometryGroupAttr, target, sampleTime,
+                       motionSample);
+
+    processWidth(geometryGroupAttr, gdp, startPtOff, target.numPoints,
+                 sampleTime, motionSample);
+
+    return true;
+}
+
+void ProceduralIterator::processWidth(
+    const FnKat::GroupAttribute& geometryGroupAttr, GU_Detail* gdp,
+    GA_Offset startPtOff, GA_Size numPoints, float sampleTime,
+    bool motionSample)
+{
+    // Mantra reads the curve and point thickness from 'width', per point or
+    // for the whole location.
+    FnKat::FloatAttribute widthAttr =
+        geometryGroupAttr.getChildByName("point.width");
+    FnKat::FloatAttribute constantWidthAttr =
+        geometryGroupAttr.getChildByName("constantWidth");
+    if (motionSample)
+    {
+        if (widthAttr.isValid() && widthAttr.getNumberOfTimeSamples() > 1
+            && widthAttr.getNumberOfValues() == numPoints)
+        {
+            GA_Attribute* width =
+                gdp->addFloatTuple(GA_ATTRIB_POINT, "width", 1);
+            setPointBlockFloats(gdp, width, startPtOff,
+                                widthAttr.getNearestSample(sampleTime));
+        }
+    }
+    else if (widthAttr.isValid() && widthAttr.getNumberOfValues() == numPoints)
+    {
+        GA_Attribute* width = gdp->addFloatTuple(GA_ATTRIB_POINT, "width", 1);
+        setPointBlockFloats(gdp, width, startPtOff,
+                            widthAttr.getNearestSample(sampleTime));
+    }
+    else if (constantWidthAttr.isValid())
+    {
+        GA_RWHandleF widthHandle(
+            gdp->addFloatTuple(GA_ATTRIB_DETAIL, "width", 1));
+        widthHandle.set(GA_Offset(0), constantWidthAttr.getValue(1.0f, false));
+    }
+}
+
+bool ProceduralIterator::processPoly(
+    FnKat::FnScenegraphIterator iterator, GU_Detail* gdp, float sampleTime,
+    bool motionSample)
+{
+    if (!iterator.isValid())
+    {
+        std::cerr << "Procedural failed: invalid iterator\n";
+        return false;
+    }
+
+    FnKat::GroupAttribute geometryGroupAttr = iterator.getAttribute("geometry");
+    if (!geometryGroupAttr.isValid())
+    {
+        std::cerr << "Procedural failed: 'geometry' group not found\n";
+        return false;
+    }
+
+    FnKat::GroupAttribute polyGroupAttr =
+        geometryGroupAttr.getChildByName("poly");
+    FnKat::GroupAttribute pointGroupAttr =
+        geometryGroupAttr.getChildByName("point");
+    FnKat::GroupAttribute vertexGroupAttr =
+        geometryGroupAttr.getChildByName("vertex");
+
+    if (!polyGroupAttr.isValid() || !pointGroupAttr.isValid())
+    {
+        std::cerr << "Procedural failed: invalid geometry'\n";
+       return false;
+    }
+
+    FnKat::FloatAttribute pointAttr = pointGroupAttr.getChildByName("P");
+    if (!pointAttr.isValid())
+    {
+        std::cerr << "Procedural failed: invalid geometry'\n";
+        return false;
+    }
+
+    FnKat::IntAttribute polyStartIndexAttr =
+        polyGroupAttr.getChildByName("startIndex");
+    FnKat::IntAttribute vertexListAttr =
+        polyGroupAttr.getChildByName("vertexList");
+    if (!polyStartIndexAttr.isValid() || !vertexListAttr.isValid())
+    {
+        std::cerr << "Procedural failed: invalid geometry'\n";
+        return false;
+    }
+
+    FnKat::FloatConstVector points = pointAttr.getNearestSample(sampleTime);
+    FnKat::IntConstVector startIndex =
+        polyStartIndexAttr.getNearestSample(0.0f);
+    FnKat::IntConstVector vertexList = vertexListAttr.getNearestSample(0.0f);
+    const GA_Size numFaces = startIndex.size() - 1;
+
+    // Chunks only build their own faces, and the points they use
+    MeshChunkTopology chunkTopology;
+    if (_meshChunk)
+    {
+        extractMeshChunk(*_meshChunk, points, startIndex, vertexList,
+                         chunkTopology);
+        points = FnKat::FloatConstVector(chunkTopology.positions.data(),
+                                         chunkTopology.positions.size());
+        startIndex = FnKat::IntConstVector(chunkTopology.startIndex.data(),
+                                           chunkTopology.startIndex.size());
+        vertexList = FnKat::IntConstVector(chunkTopology.vertexList.data(),
+                                           chunkTopology.vertexList.size());
+    }
+
+    const GA_Offset startPtOff = appendPointBlock(gdp, points);
+    const GA_Offset startPrimOff = buildPolygonBlock(
+        gdp, startPtOff, points.size() / 3, startIndex, vertexList);
+    if (startPrimOff == GA_INVALID_OFFSET)
+    {
+        std::cerr << "Procedural failed: invalid topology for '"
+                  << iterator.getFullName() << "'\n";
+        return false;
+    }
+
+    // Katana ends 'startIndex' with the size of the vertex list. Faces with
+    // no vertices were not built, so later faces are shifted.
+    AttributeTarget target;
+    target.startPointOffset = startPtOff;
+    target.numPoints = points.size() / 3;
+    target.startPrimitiveOffset = startPrimOff;
+    target.numFaces = numFaces;
+    target.startVertexOffset =
+        gdp->getPrimitive(startPrimOff)->getVertexOffset(0);
+    target.numVertices = vertexList.size();
+    if (_meshChunk)
+    {
+        target.sourcePoints = chunkTopology.points;
+        target.sourceVertices = chunkTopology.vertices;
+        target.primitiveFaces = _meshChunk->faces;
+    }
+    for (GA_Size i = 0; i < target.numFaces && !_meshChunk; ++i)
+    {
+        if (startIndex[i + 1] == startIndex[i])
+        {
+            for (GA_Size j = 0; j < target.numFaces; ++j)
+            {
+                if (startIndex[j + 1] > startIndex[j])
+                {
+                    target.primitiveFaces.push_back(j);
+                }
+            }
+            break;
+        }
+    }
+    transferAttributes(gdp, geometryGroupAttr, target, sampleTime,
+                       motionSample);
+    if (motionSample)
+    {
+        return true;
+    }
+
+    processFacesets(iterator, gdp, target);
+
+    // The cage is subdivided by Mantra, which only needs the crease and
+    // corner weights to match the Katana limit surface.
+    if (iterator.getType() == "subdmesh")
+    {
+        FnKat::IntAttribute creaseIndexAttr =
+            geometryGroupAttr.getChildByName("creaseIndex");
+        FnKat::IntAttribute creaseLengthsAttr =
+            geometryGroupAttr.getChildByName("creaseLengths");
+        FnKat::FloatAttribute creaseSharpnessAttr =
+            geometryGroupAttr.getChildByName("creaseSharpness");
+        if (creaseIndexAttr.isValid() && creaseLengthsAttr.isValid()
+            && creaseSharpnessAttr.isValid())
+        {
+            setCreaseWeights(gdp, startPrimOff, startIndex, vertexList,
+                             creaseIndexAttr.getNearestSample(0.0f),
+                             creaseLengthsAttr.getNearestSample(0.0f),
+                             creaseSharpnessAttr.getNearestSample(0.0f));
+        }
+
+        FnKat::IntAttribute cornerIndexAttr =
+            geometryGroupAttr.getChildByName("cornerIndex");
+        FnKat::FloatAttribute cornerSharpnessAttr =
+            geometryGroupAttr.getChildByName("cornerSharpness");
+        if (cornerIndexAttr.isValid() && cornerSharpnessAttr.isValid())
+        {
+            setCornerWeights(gdp, startPtOff, points.size() / 3,
+                             cornerIndexAttr.getNearestSample(0.0f),
+                             cornerSharpnessAttr.getNearestSample(0.0f));
+        }
+    }
+
+    return true;
+}
+
+void ProceduralIterator::processFacesets(FnKat::FnScenegraphIterator iterator,
+                                         GU_Detail* gdp,
+                                         const AttributeTarget& target)
+{
+    // Primitive of each face, faces with no vertices were not built
+    std::vector<GA_Offset> facePrimitives(target.numFaces, GA_INVALID_OFFSET);
+    if (target.primitiveFaces.empty())
+    {
+        for (GA_Size i = 0; i < target.numFaces; ++i)
+        {
+            facePrimitives[i] = target.startPrimitiveOffset + i;
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < target.primitiveFaces.size(); ++i)
+        {
+            facePrimitives[target.primitiveFaces[i]] =
+                target.startPrimitiveOffset + i;
+        }
+    }
+
+    // Each faceset becomes a primitive group. Facesets with a material of
+    // their own override the object shader on their faces.
+    GA_RWHandleS shaderHandle;
+    FnKat::FnScenegraphIterator childSgIterator = iterator.getFirstChild();
+    for (; childSgIterator.isValid();
+         childSgIterator = childSgIterator.getNextSibling())
+    {
+        if (childSgIterator.getType() != "faceset")
+        {
+            continue;
+        }
+
+        FnKat::IntAttribute facesAttr =
+            childSgIterator.getAttribute("geometry.faces");
+        if (!facesAttr.isValid())
+        {
+            continue;
+        }
+
+        const std::string shader =
+            getShaderString(childSgIterator.getAttribute("material"));
+        if (!shader.empty() && !shaderHandle.isValid())
+        {
+            shaderHandle = GA_RWHandleS(gdp->addStringTuple(
+                GA_ATTRIB_PRIMITIVE, "shop_vm_surface", 1));
+        }
+
+        GA_PrimitiveGroup* group =
+            gdp->newPrimitiveGroup(childSgIterator.getName().c_str());
+        const FnKat::IntConstVector faces = facesAttr.getNearestSample(0.0f);
+        for (size_t i = 0; i < faces.size(); ++i)
+        {
+            if (faces[i] < 0 || faces[i] >= target.numFaces
+                || facePrimitives[faces[i]] == GA_INVALID_OFFSET)
+            {
+                continue;
+            }
+
+            group->addOffset(facePrimitives[faces[i]]);
+            if (!shader.empty())
+            {
+                shaderHandle.set(facePrimitives[faces[i]], shader.c_str());
+            }
+        }
+    }
+}
+
+std::vector<float> ProceduralIterator::getGeometrySampleTimes(
+    const FnKat::DataAttribute& attr) const
+{
+    const ProceduralSettings& settings = _context->getSettings();
+
+    std::vector<float> sampleTimes;
+    if (attr.isValid() && attr.getNumberOfTimeSamples() > 1
+        && settings.shutterClose > settings.shutterOpen)
+    {
+        std::set<float> attrSampleTimes;
+        for (int64_t i = 0; i < attr.getNumberOfTimeSamples(); ++i)
+        {
+            attrSampleTimes.insert(attr.getSampleTime(i));
+        }
+
+        FnKat::RenderOutputUtils::findSampleTimesRelevantToShutterRange(
+            sampleTimes, attrSampleTimes,
+            settings.shutterOpen, settings.shutterClose);
+    }
+
+    if (sampleTimes.empty())
+    {
+        sampleTimes.push_back(0.0f);
+    }
+
+    return sampleTimes;
+}
+
+GU_Detail* ProceduralIterator::allocateLocationGeometry()
+{
+    UT_AutoLock lock(_geometryLock);
+    return allocateGeometry();
+}
+
+void ProceduralIterator::freeLocationGeometry(GU_Detail* gdp)
+{
+    UT_AutoLock lock(_geometryLock);
+    freeGeometry(gdp);
+}
+
+void ProceduralIterator::processTransform(FnKat::FnScenegraphIterator iterator)
+{
+    const std::vector<UT_Matrix4D>& xforms = getWorldXforms(iterator);
+    if (!xforms.empty())
+    {
+        processTransform(xforms);
+    }
+}
+
+void ProceduralIterator::processTransform(
+    const std::vector<UT_Matrix4D>& xforms)
+{
+    const ProceduralSettings& settings = _context->getSettings();
+
+    if (xforms.size() == 1)
+    {
+        setPreTransform(xforms[0], 0.0f);
+        return;
+    }
+
+    // One motion segment per sample time
+    for (size_t i = 0; i < xforms.size(); ++i)
+    {
+        setPreTransform(xforms[i],
+                        settings.getShutterOffset(settings.sampleTimes[i]));
+    }
+}
+
+const std::vector<UT_Matrix4D>& ProceduralIterator::getWorldXforms(
+    FnKat::FnScenegraphIterator iterator) const
+{
+    TransformCache& cache = _context->getTransformCache();
+    const std::string path = iterator.getFullName();
+
+    const std::vector<UT_Matrix4D>* cachedXforms = cache.find(path);
+    if (cachedXforms)
+    {
+        return *cachedXforms;
+    }
+
+    // Identity transforms are stored empty, and never set on objects
+    std::vector<UT_Matrix4D> xforms;
+    computeWorldXforms(iterator, xforms);
+    return cache.insert(path, xforms);
+}
+
+void ProceduralIterator::computeWorldXforms(
+    FnKat::FnScenegraphIterator iterator,
+    std::vector<UT_Matrix4D>& xforms) const
+{
+    xforms.clear();
+
+    // Only the local transform is evaluated, ancestors come from the cache
+    std::vector<UT_Matrix4D> localXforms;
+    bool isAbsolute = false;
+    FnKat::GroupAttribute xformAttr = iterator.getAttribute("xform");
+    if (xformAttr.isValid())
+    {
+        const ProceduralSettings& settings = _context->getSettings();
+
+        FnKat::RenderOutputUtils::XFormMatrixVector sampleXforms;
+        FnKat::RenderOutputUtils::calcXFormsFromAttr(
+            sampleXforms, isAbsolute, xformAttr, settings.sampleTimes,
+            FnKat::RenderOutputUtils::kAttributeInterpolation_Linear);
+
+        bool isIdentity = true;
+        for (size_t i = 0; i < sampleXforms.size(); ++i)
+        {
+            const double* m = sampleXforms[i].getValues();
+            localXforms.push_back(UT_Matrix4D((double(*)[4])m));
+            isIdentity = isIdentity && localXforms[i].isIdentity();
+        }
+
+        if (isIdentity)
+        {
+            localXforms.clear();
+        }
+    }
+
+    static const std::vector<UT_Matrix4D> noXforms;
+    FnKat::FnScenegraphIterator parentSgIterator = iterator.getParent();
+    const std::vector<UT_Matrix4D>& parentXforms =
+        !isAbsolute && parentSgIterator.isValid()
+        ? getWorldXforms(parentSgIterator) : noXforms;
+
+    if (localXforms.empty() || parentXforms.empty())
+    {
+        xforms = localXforms.empty() ? parentXforms : localXforms;
+    }
+    else
+    {
+        // A static side is reused for every sample of the other one
+        const size_t numSamples =
+            std::max(localXforms.size(), parentXforms.size());
+        for (size_t i = 0; i < numSamples; ++i)
+        {
+            xforms.push_back(
+                localXforms[std::min(i, localXforms.size() - 1)]
+                * parentXforms[std::min(i, parentXforms.size() - 1)]);
+        }
+    }
+
+    // Static transforms don't need motion segments
+    bool isStatic = true;
+    for (size_t i = 1; i < xforms.size() && isStatic; ++i)
+    {
+        isStatic = (xforms[i] == xforms[0]);
+    }
+    if (isStatic && xforms.size() > 1)
+    {
+        xforms.resize(1);
+    }
+}
+
+bool ProceduralIterator::getLocationBound(
+    FnKat::FnScenegraphIterator iterator, UT_BoundingBox& bbox) const
+{
+    FnKat::DoubleAttribute boundAttr = iterator.getAttribute("bound");
+    if (!boundAttr.isValid() || 6 != boundAttr.getNumberOfValues())
+    {
+        // Only leaf locations are measured, bounding a group would cook its
+        // whole subtree. Groups are expanded instead, and their children
+        // deferred on their own. Empty leaves have nothing to defer.
+        const std::string type = iterator.getType();
+        const bool isLeaf = type == "polymesh" || type == "subdmesh"
+            || type == "curves" || type == "pointcloud" || type == "instance"
+            || type == "instance array";
+        return isLeaf && getComputedBound(iterator, bbox) && bbox.isValid();
+    }
+
+    // Deforming locations give one bound per sample time
+    UT_BoundingBox localBBox;
+    localBBox.initBounds();
+    for (int64_t i = 0; i < boundAttr.getNumberOfTimeSamples(); ++i)
+    {
+        const FnKat::DoubleConstVector boundValues =
+            boundAttr.getNearestSample(boundAttr.getSampleTime(i));
+        localBBox.enlargeBounds(UT_BoundingBox(
+            boundValues[0], boundValues[2], boundValues[4],
+            boundValues[1], boundValues[3], boundValues[5]));
+    }
+
+    // 'bound' is expressed in the location space, while procedurals and
+    // geometry objects all live in world space. With motion blur, the bound
+    // has to enclose the location at every sample time.
+    const std::vector<UT_Matrix4D>& xforms = getWorldXforms(iterator);
+    if (xforms.empty())
+    {
+        bbox = localBBox;
+        return true;
+    }
+
+    bbox.initBounds();
+    for (size_t i = 0; i < xforms.size(); ++i)
+    {
+        UT_BoundingBox sampleBBox(localBBox);
+        sampleBBox.transform(xforms[i]);
+        bbox.enlargeBounds(sampleBBox);
+    }
+
+    return true;
+}
+
+bool ProceduralIterator::getComputedBound(
+    FnKat::FnScenegraphIterator iterator, UT_BoundingBox& bbox) const
+{
+    BoundCache& cache = _context->getBoundCache();
+    const std::string path = iterator.getFullName();
+
+    const BoundCache::Entry* entry = cache.find(path);
+    if (!entry)
+    {
+        UT_BoundingBox computedBBox;
+        computedBBox.initBounds();
+        const bool valid = computeLocationBound(iterator, computedBBox);
+        entry = &cache.insert(path, computedBBox, valid);
+    }
+
+    bbox = entry->bbox;
+    return entry->valid;
+}
+
+bool ProceduralIterator::computeLocationBound(
+    FnKat::FnScenegraphIterator iterator, UT_BoundingBox& bbox) const
+{
+    const std::string type = iterator.getType();
+    if (type == "instance")
+    {
+        return computeInstanceBound(iterator, bbox);
+    }
+    if (type == "instance array")
+    {
+        return computeInstanceArrayBound(iterator, bbox);
+    }
+
+    const std::vector<UT_Matrix4D>& worldXforms = getWorldXforms(iterator);
+    const std::vector<UT_Matrix4D>& xforms =
+        worldXforms.empty() ? getIdentityXforms() : worldXforms;
+
+    // Leaf geometry: positions at every sample time, moved by every
+    // transform sample.
+    FnKat::FloatAttribute pointAttr =
+        iterator.getAttribute("geometry.point.P");
+    if (pointAttr.isValid())
+    {
+        UT_BoundingBox localBBox;
+        localBBox.initBounds();
+
+        const std::vector<float> sampleTimes =
+            getGeometrySampleTimes(pointAttr);
+        for (size_t i = 0; i < sampleTimes.size(); ++i)
+        {
+            enlargePointBounds(localBBox,
+                               pointAttr.getNearestSample(sampleTimes[i]));
+        }
+
+        if (localBBox.isValid())
+        {
+            for (size_t i = 0; i < xforms.size(); ++i)
+            {
+                UT_BoundingBox sampleBBox(localBBox);
+                sampleBBox.transform(xforms[i]);
+                bbox.enlargeBounds(sampleBBox);
+            }
+        }
+        return true;
+    }
+
+    // Groups: union of the children, already in world space. Instance sources
+    // below the group are only rendered through their instances.
+    std::vector<FnKat::FnScenegraphIterator> children;
+    std::vector<std::string> childPaths;
+    FnKat::FnScenegraphIterator childSgIterator = iterator.getFirstChild();
+    while (childSgIterator.isValid())
+    {
+        if (childSgIterator.getType() != "instance source"
+            && isLocationRendered(childSgIterator))
+        {
+            children.push_back(childSgIterator);
+            childPaths.push_back(childSgIterator.getFullName());
+        }
+        childSgIterator = childSgIterator.getNextSibling();
+    }
+
+    // Children picked up by worker threads are read through their client
+    const std::thread::id thread = std::this_thread::get_id();
+    std::vector<UT_BoundingBox> childBBoxes(children.size());
+    std::vector<char> childValid(children.size(), 0);
+    auto computeChild = [&](size_t i)
+    {
+        FnKat::FnScenegraphIterator child =
+            getThreadIterator(children[i], childPaths[i], thread);
+        childValid[i] = child.isValid()
+            && getComputedBound(child, childBBoxes[i]);
+    };
+
+    if (_context->getSettings().parallelTranslation && children.size() > 1)
+    {
+        UTparallelForHeavyItems(UT_BlockedRange<size_t>(0, children.size()),
+            [&](const UT_BlockedRange<size_t>& range)
+            {
+                for (size_t i = range.begin(); i != range.end(); ++i)
+                {
+                    computeChild(i);
+                }
+            });
+    }
+    else
+    {
+        for (size_t i = 0; i < children.size(); ++i)
+        {
+            computeChild(i);
+        }
+    }
+
+    for (size_t i = 0; i < children.size(); ++i)
+    {
+        if (!childValid[i])
+        {
+            return false;
+        }
+
+        if (childBBoxes[i].isValid())
+        {
+            bbox.enlargeBounds(childBBoxes[i]);
+        }
+    }
+
+    return true;
+}
+
+bool ProceduralIterator::getInstanceSourceBound(
+    FnKat::FnScenegraphIterator iterator, UT_BoundingBox& bbox) const
+{
+    if (!iterator.isValid() || !getComputedBound(iterator, bbox))
+    {
+        return false;
+    }
+
+    // Instances place the source relative to its own transform
+    const std::vector<UT_Matrix4D>& sourceXforms = getWorldXforms(iterator);
+    if (bbox.isValid() && !sourceXforms.empty())
+    {
+        UT_Matrix4D sourceXform = sourceXforms[0];
+        sourceXform.invert();
+        bbox.transform(sourceXform);
+    }
+
+    return true;
+}
+
+bool ProceduralIterator::computeInstanceBound(
+    FnKat::FnScenegraphIterator iterator, UT_BoundingBox& bbox) const
+{
+    FnKat::StringAttribute sourceAttr =
+        iterator.getAttribute("geometry.instanceSource");
+    const std::string sourcePath = sourceAttr.getValue("", false);
+
+    UT_BoundingBox sourceBBox;
+    if (sourcePath.empty()
+        || !getInstanceSourceBound(iterator.getByPath(sourcePath), sourceBBox))
+    {
+        return false;
+    }
+
+    if (!sourceBBox.isValid())
+    {
+        return true;
+    }
+
+    const std::vector<UT_Matrix4D>& worldXforms = getWorldXforms(iterator);
+    const std::vector<UT_Matrix4D>& xforms =
+        worldXforms.empty() ? getIdentityXforms() : worldXforms;
+
+    for (size_t i = 0; i < xforms.size(); ++i)
+    {
+        UT_BoundingBox sampleBBox(sourceBBox);
+        sampleBBox.transform(xforms[i]);
+        bbox.enlargeBounds(sampleBBox);
+    }
+
+    return true;
+}
+
+bool ProceduralIterator::computeInstanceArrayBound(
+    FnKat::FnScenegraphIterator iterator, UT_BoundingBox& bbox) const
+{
+    FnKat::StringAttribute sourcesAttr =
+        iterator.getAttribute("geometry.instanceSource");
+    std::vector<double> matrices;
+    if (!sourcesAttr.isValid()
+        || !getInstanceMatrices(iterator.getAttribute("geometry"), matrices))
+    {
+        return false;
+    }
+
+    // Union of all the sources, so that every instance is moved only once
+    UT_BoundingBox sourcesBBox;
+    sourcesBBox.initBounds();
+    const FnKat::StringConstVector sourcePaths =
+        sourcesAttr.getNearestSample(0.0f);
+    for (size_t i = 0; i < sourcePaths.size(); ++i)
+    {
+        UT_BoundingBox sourceBBox;
+        if (!getInstanceSourceBound(iterator.getByPath(sourcePaths[i]),
+                                    sourceBBox))
+        {
+            return false;
+        }
+
+        if (sourceBBox.isValid())
+        {
+            sourcesBBox.enlargeBounds(sourceBBox);
+        }
+    }
+
+    if (!sourcesBBox.isValid())
+    {
+        return true;
+    }
+
+    const std::vector<UT_Matrix4D>& worldXforms = getWorldXforms(iterator);
+    const std::vector<UT_Matrix4D>& xforms =
+        worldXforms.empty() ? getIdentityXforms() : worldXforms;
+
+    for (size_t i = 0; i + 16 <= matrices.size(); i += 16)
+    {
+        const UT_Matrix4D instanceXform((double(*)[4])(matrices.data() + i));
+        for (size_t j = 0; j < xforms.size(); ++j)
+        {
+            UT_BoundingBox instanceBBox(sourcesBBox);
+            instanceBBox.transform(instanceXform * xforms[j]);
+            bbox.enlargeBounds(instanceBBox);
+        }
+    }
+
+    return true;
+}
+
+// TODO: Avoid code duplication! See RendererPlugin/src/MantraRendererPlugin.cpp
+template <typename T>
+std::string ProceduralIterator::buildPropertyString(T attr) const
+{
+    assert(attr.isValid());
+
+    std::ostringstream ss;
+    FnKat::ConstVector<typename T::value_type> vec =
+        attr.getNearestSample(0.0f);
+
+    for (size_t i = 0; i < vec.size(); ++i)
+    {
+        ss << " " << vec.at(i);
+    }
+    return ss.str();
+}
+
+void ProceduralIterator::processMaterial(FnKat::FnScenegraphIterator iterator)
+{
+    const std::string shader =
+        getShaderString(iterator.getAttribute("material", true));
+    if (!shader.empty())
+    {
+        changeSetting("surface", shader.c_str(), "object");
+    }
+}
+
+std::string ProceduralIterator::getShaderString(
+    const FnKat::GroupAttribute& matAttr) const
+{
+    if (!matAttr.isValid())
+    {
+        return std::string();
+    }
+
+    // Locations sharing a material get the same shader string, which Mantra
+    // resolves to a single shader instance.
+    MaterialCache& cache = _context->getMaterialCache();
+    const std::string key = matAttr.getHash().str();
+
+    std::string shader;
+    if (!cache.find(key, shader))
+    {
+        shader = buildShaderString(matAttr);
+        cache.insert(key, shader);
+    }
+
+    return shader;
+}
+
+std::string ProceduralIterator::buildShaderString(
+    const FnKat::GroupAttribute& matAttr) const
+{
+    FnKat::StringAttribute matNameAttr = matAttr.getChildByName(
+        "mantra13SurfaceShader");
+    const std::string matName = matNameAttr.getValue("", false);
+
+    if (matName.empty())
+    {
+        return std::string();
+    }
+
+    std::ostringstream ss;
+    ss << "opdef:/Shop/" << matName;
+
+    // Build the shader's parameters string
+    FnKat::GroupAttribute params = matAttr.getChildByName(
+        "mantra13SurfaceParams");
+    for (int i = 0; i < params.getNumberOfChildren(); ++i)
+    {
+        const std::string attrName = params.getChildName(i);
+        FnKat::DataAttribute attr = params.getChildByIndex(i);
+
+        if (attr.isValid())
+        {
+            std::string attrStr;
+            switch (attr.getType())
+            {
+                case kFnKatAttributeTypeInt:
+                    attrStr = buildPropertyString<FnKat::IntAttribute>(attr);
+                    break;
+
+                case kFnKatAttributeTypeFloat:
+                    attrStr = buildPropertyString<FnKat::FloatAttribute>(attr);
+                    break;
+
+                case kFnKatAttributeTypeDouble:
+                    attrStr = buildPropertyString<FnKat::DoubleAttribute>(attr);
+                    break;
+
+                case kFnKatAttributeTypeString:
+                    attrStr = buildPropertyString<FnKat::StringAttribute>(attr);
+                    break;
+
+                default:
+                    std::cerr << "Warning: unknown attribute type for '"
+                              << attrName << "'\n";
+                    continue;
+            }
+            ss << " " << attrName << " " << attrStr << "\n";
+        }
+    }
+
+    return ss.str();
 }
 
 } // namespace ds_mfk
@@ -0,0 +1,190 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include "ResidencyManager.h"
+
+namespace ds_mfk {
+
+ResidencyManager::ResidencyManager(int64_t budget,
+                                   const std::string& spillDirectory)
+    : _budget(budget), _spillDirectory(spillDirectory), _locationBytes(0),
+      _meshBytes(0), _spillFailed(false)
+{
+}
+
+ResidencyManager::~ResidencyManager()
+{
+    if (_tmpDirectory.empty())
+    {
+        return;
+    }
+
+    DIR* dir = opendir(_tmpDirectory.c_str());
+    if (dir)
+    {
+        while (dirent* entry = readdir(dir))
+        {
+            const std::string name = entry->d_name;
+            if (name != "." && name != "..")
+            {
+                std::remove((_tmpDirectory + "/" + name).c_str());
+            }
+        }
+        closedir(dir);
+    }
+    rmdir(_tmpDirectory.c_str());
+}
+
+bool ResidencyManager::isOverBudget() const
+{
+    if (!isEnabled())
+    {
+        return false;
+    }
+
+    UT_AutoLock lock(_lock);
+    return _locationBytes + _meshBytes > _budget;
+}
+
+void ResidencyManager::addLocation(int64_t bytes)
+{
+    if (!isEnabled())
+    {
+        return;
+    }
+
+    UT_AutoLock lock(_lock);
+    _locationBytes += bytes;
+}
+
+void ResidencyManager::addMesh(const std::string& key, int64_t bytes)
+{
+    if (!isEnabled())
+    {
+        return;
+    }
+
+    UT_AutoLock lock(_lock);
+
+    if (_meshes.insert(key).second)
+    {
+        _meshBytes += bytes;
+    }
+}
+
+bool ResidencyManager::canSpill() const
+{
+    UT_AutoLock lock(_lock);
+    return isEnabled() && !_spillFailed;
+}
+
+bool ResidencyManager::isMeshSpilled(const std::string& key) const
+{
+    const DiskGeometryCache* spillCache = getSpillCache();
+    return spillCache && spillCache->contains(key);
+}
+
+bool ResidencyManager::spillMesh(const std::string& key, GU_Detail& gdp)
+{
+    if (!isEnabled())
+    {
+        return false;
+    }
+
+    {
+        UT_AutoLock lock(_lock);
+
+        if (!_spillCache && !_spillFailed)
+        {
+            std::string directory = _spillDirectory;
+            if (directory.empty())
+            {
+                const char* tmpRoot = getenv("TMPDIR");
+                std::string tmpDirectory = (tmpRoot && tmpRoot[0])
+                    ? tmpRoot : "/tmp";
+                tmpDirectory += "/mantra_katana_spill_XXXXXX";
+                if (mkdtemp(&tmpDirectory[0]))
+                {
+                    _tmpDirectory = tmpDirectory;
+                    directory = _tmpDirectory;
+                }
+                else
+                {
+                    std::cerr << "Procedural warning: unable to create spill "
+                              << "directory, geometry will stay in memory\n";
+                    _spillFailed = true;
+                }
+            }
+
+            if (!directory.empty())
+            {
+                _spillCache.reset(new DiskGeometryCache(directory));
+            }
+        }
+    }
+
+    const DiskGeometryCache* spillCache = getSpillCache();
+    return spillCache && spillCache->save(key, gdp);
+}
+
+std::string ResidencyManager::getSpillPath(const std::string& key) const
+{
+    const DiskGeometryCache* spillCache = getSpillCache();
+    return spillCache ? spillCache->getPath(key) : std::string();
+}
+
+const DiskGeometryCache* ResidencyManager::getSpillCache() const
+{
+    // Once created the cache is never replaced
+    UT_AutoLock lock(_lock);
+    return _spillCache.get();
+}
+
+} // namespace ds_mfk
@@ -0,0 +1,262 @@
+// *****************************************************************************
+//
+// Copyright (c) 2014-2019, Davide Selmo.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// * Neither the name of Davide Selmo nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// -----------------------------------------------------------------------------
+//
+// This software is provided "as is", and is entirely unconnected to any
+// development work done by The Foundry or Side Effects.
+//
+// Please don't use the usual The Foundry or Side Effects support channels
+// for any questions or issues relating to this software.
+// Email ds_gfx@zoho.com instead.
+//
+// All trademarks are the properties of their respective holders.
+//
+// *****************************************************************************
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include "TranslationStats.h"
+
+namespace ds_mfk {
+
+namespace {
+
+// Number of locations listed as the slowest and largest ones
+const size_t kNumTopLocations = 20;
+
+double getTotalTime(const LocationStats& stats)
+{
+    return stats.cookTime + stats.convertTime;
+}
+
+bool isFaster(const LocationStats& a, const LocationStats& b)
+{
+    return getTotalTime(a) < getTotalTime(b);
+}
+
+bool isSmaller(const LocationStats& a, const LocationStats& b)
+{
+    return a.bytes < b.bytes;
+}
+
+// Keeps the 'kNumTopLocations' greatest locations according to 'isLess', as
+// a heap whose front is the least of them.
+template <typename Compare>
+void keepTopLocation(std::vector<LocationStats>& locations,
+                     const LocationStats& stats, Compare isLess)
+{
+    auto isGreater = [&](const LocationStats& a, const LocationStats& b)
+    {
+        return isLess(b, a);
+    };
+
+    if (locations.size() < kNumTopLocations)
+    {
+        locations.push_back(stats);
+        std::push_heap(locations.begin(), locations.end(), isGreater);
+    }
+    else if (isLess(locations.front(), stats))
+    {
+        std::pop_heap(locations.begin(), locations.end(), isGreater);
+        locations.back() = stats;
+        std::push_heap(locations.begin(), locations.end(), isGreater);
+    }
+}
+
+std::string escapeJson(const std::string& value)
+{
+    std::string escaped;
+    escaped.reserve(value.size());
+    for (size_t i = 0; i < value.size(); ++i)
+    {
+        const char c = value[i];
+        if (c == '"' || c == '\\')
+        {
+            escaped += '\\';
+            escaped += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        }
+        else
+        {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+void writeCounts(std::ostream& out, double cookTime, double convertTime,
+                 int64_t numPoints, int64_t numPrimitives,
+                 int64_t numVertices, int64_t bytes)
+{
+    out << "\"cookTime\": " << cookTime
+        << ", \"convertTime\": " << convertTime
+        << ", \"points\": " << numPoints
+        << ", \"primitives\": " << numPrimitives
+        << ", \"vertices\": " << numVertices
+        << ", \"bytes\": " << bytes;
+}
+
+void writeLocations(std::ostream& out, const char* name,
+                    std::vector<LocationStats> locations,
+                    bool (*isLess)(const LocationStats&, const LocationStats&))
+{
+    std::sort(locations.begin(), locations.end(),
+        [&](const LocationStats& a, const LocationStats& b)
+        {
+            return isLess(b, a);
+        });
+
+    out << "  \"" << name << "\": [";
+    for (size_t i = 0; i < locations.size(); ++i)
+    {
+        const LocationStats& stats = locations[i];
+        out << (i ? ",\n" : "\n")
+            << "    {\"path\": \"" << escapeJson(stats.path)
+            << "\", \"type\": \"" << escapeJson(stats.type) << "\", ";
+        writeCounts(out, stats.cookTime, stats.convertTime, stats.numPoints,
+                    stats.numPrimitives, stats.numVertices, stats.bytes);
+        out << "}";
+    }
+    out << "\n  ]";
+}
+
+} // namespace
+
+void LocationStats::addGeometry(const GU_Detail& gdp)
+{
+    numPoints += gdp.getNumPoints();
+    numPrimitives += gdp.getNumPrimitives();
+    numVertices += gdp.getNumVertices();
+    bytes += gdp.getMemoryUsage(true);
+}
+
+void TranslationStats::Totals::add(const LocationStats& stats)
+{
+    ++numLocations;
+    cookTime += stats.cookTime;
+    convertTime += stats.convertTime;
+    numPoints += stats.numPoints;
+    numPrimitives += stats.numPrimitives;
+    numVertices += stats.numVertices;
+    bytes += stats.bytes;
+}
+
+TranslationStats::TranslationStats(const std::string& reportPath)
+    : _reportPath(reportPath), _written(false)
+{
+}
+
+TranslationStats::~TranslationStats()
+{
+    if (isEnabled() && !_written)
+    {
+        writeReport();
+    }
+}
+
+void TranslationStats::record(const LocationStats& stats)
+{
+    if (!isEnabled())
+    {
+        return;
+    }
+
+    UT_AutoLock lock(_lock);
+
+    _totals.add(stats);
+    _typeTotals[stats.type].add(stats);
+    keepTopLocation(_slowest, stats, isFaster);
+    keepTopLocation(_largest, stats, isSmaller);
+    _written = false;
+}
+
+void TranslationStats::finish()
+{
+    if (!isEnabled())
+    {
+        return;
+    }
+
+    if (writeReport())
+    {
+        UT_AutoLock lock(_lock);
+        _written = true;
+    }
+}
+
+bool TranslationStats::writeReport() const
+{
+    UT_AutoLock lock(_lock);
+
+    std::ofstream out(_reportPath.c_str());
+    if (!out)
+    {
+        std::cerr << "Procedural warning: unable to write statistics to '"
+                  << _reportPath << "'\n";
+        return false;
+    }
+
+    out << "{\n  \"totals\": {\"locations\": " << _totals.numLocations << ", ";
+    writeCounts(out, _totals.cookTime, _totals.convertTime,
+                _totals.numPoints, _totals.numPrimitives,
+                _totals.numVertices, _totals.bytes);
+    out << "},\n  \"types\": {";
+
+    for (auto it = _typeTotals.begin(); it != _typeTotals.end(); ++it)
+    {
+        const Totals& totals = it->second;
+        out << (it == _typeTotals.begin() ? "\n" : ",\n")
+            << "    \"" << escapeJson(it->first) << "\": {\"locations\": "
+            << totals.numLocations << ", ";
+        writeCounts(out, totals.cookTime, totals.convertTime,
+                    totals.numPoints, totals.numPrimitives,
+                    totals.numVertices, totals.bytes);
+        out << "}";
+    }
+    out << "\n  },\n";
+
+    writeLocations(out, "slowest", _slowest, isFaster);
+    out << ",\n";
+    writeLocations(out, "largest", _largest, isSmaller);
+    out << "\n}\n";
+
+    return out.good();
+}
+
+} // namespace ds_mfk
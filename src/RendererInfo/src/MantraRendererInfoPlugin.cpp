@@ -169,10 +169,10 @@ bool MantraRendererInfoPlugin::isNodeTypeSupported(
 bool MantraRendererInfoPlugin::isPolymeshFacesetSplittingEnabled() const
 {
     // If true is returned, Katana will split geometry automatically before
-    // calling the Render plug-in.
+    // calling the Render plug-in. Facesets are handled by the procedural,
+    // which keeps each mesh as a single object.
 
-    return FnKat::RendererInfo::RendererInfoBase::
-        isPolymeshFacesetSplittingEnabled();
+    return false;
 }
 
 void MantraRendererInfoPlugin::fillShaderInputNames(
@@ -99,13 +99,19 @@ private:
     bool buildHeader(FnKat::FnScenegraphIterator rootIterator);
     bool buildRenderCamera(FnKat::FnScenegraphIterator rootIteratorm,
                            FnKat::Render::RenderSettings& settings);
-    void buildMainProcedural();
+    void buildMainProcedural(FnKat::Render::RenderSettings& settings);
+    float getGeometryBudget(FnKat::FnScenegraphIterator rootIterator) const;
+    bool getFrustumCulling(FnKat::FnScenegraphIterator rootIterator,
+                           float& margin) const;
+    void getMotionSampleTimes(FnKat::Render::RenderSettings& settings,
+                              std::vector<float>& sampleTimes) const;
 
     template <typename T>
     std::string buildPropertyString(T attr) const;
     void parseGlobalProperties(FnKat::FnScenegraphIterator rootIterator);
 
     std::string _scriptFilePath;
+    std::string _cameraArgs;
     MantraWrapper _mantra;
 };
 
@@ -44,6 +44,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <cstdlib>
 #include <sstream>
 
 #include <OpenEXR/ImathMatrix.h>
@@ -98,7 +99,7 @@ int MantraRendererPlugin::start()
         return -1;
     }
 
-    buildMainProcedural();
+    buildMainProcedural(renderSettings);
 
     // Start the render
     _mantra.sendCommand("ray_raytrace");
@@ -228,10 +229,6 @@ bool MantraRendererPlugin::buildHeader(FnKat::FnScenegraphIterator rootIterator)
     _mantra.sendCommand("ray_property plane channel \"C\"");
     _mantra.sendCommand("ray_end");
 
-    // Thread count
-    // FIXME: Remove when 'threadcount' will be added to MantraGlobalSettings.xml
-    _mantra.sendCommand("ray_property global threadcount 1");
-
     return true;
 }
 
@@ -291,13 +288,21 @@ bool MantraRendererPlugin::buildRenderCamera(
     _mantra.sendCommand("ray_property image window 0 1 0 1");
     _mantra.sendCommand("ray_property image crop 0 1 0 1");
 
+    // Shutter interval, relative to the current frame
+    const float shutterOpen = settings.getShutterOpen();
+    const float shutterClose = settings.getShutterClose();
+    if (shutterClose > shutterOpen)
+    {
+        _mantra << "ray_property camera shutter " << shutterOpen
+                << " " << shutterClose << MantraWrapper::endl;
+    }
+
     // Build camera transform
     FnKat::GroupAttribute xformAttr =
         FnKat::RenderOutputUtils::getCollapsedXFormAttr(cameraIterator);
 
-    // FIXME: no motion blur a.t.m.
     std::vector<float> relevantSampleTimes;
-    relevantSampleTimes.push_back(0.0f);
+    getMotionSampleTimes(settings, relevantSampleTimes);
 
     bool isAbsolute;
     FnKat::RenderOutputUtils::XFormMatrixVector xforms;
@@ -306,18 +311,47 @@ bool MantraRendererPlugin::buildRenderCamera(
         relevantSampleTimes,
         FnKat::RenderOutputUtils::kAttributeInterpolation_Linear);
 
-    const double* xformValues = xforms[0].getValues();
-    Imath::M44d mat((double(*)[4])xformValues);
-    mat.invert();
+    // Additional motion segments are declared by 'ray_mtransform'
+    for (size_t i = 0; i < xforms.size(); ++i)
+    {
+        const double* sampleValues = xforms[i].getValues();
+        Imath::M44d mat((double(*)[4])sampleValues);
+        mat.invert();
+
+        const double* elems = mat.getValue();
+        std::ostringstream ssXform;
+        ssXform << (i == 0 ? "ray_transform " : "ray_mtransform ");
+        for (size_t j = 0; j < 16; ++j)
+        {
+            ssXform << elems[j] << " ";
+        }
+        _mantra.sendCommand(ssXform.str());
+    }
 
-    const double* elems = mat.getValue();
-    std::ostringstream ssXform;
-    ssXform << "ray_transform ";
+    // Handed to the main procedural, which culls the locations out of view
+    // and selects levels of detail. Camera to world transforms at shutter
+    // open and close.
+    std::ostringstream cameraArgs;
+    cameraArgs << "cameraFov " << fov << " ";
+    cameraArgs << "cameraResolution " << dataWindowSize[0] << " "
+               << dataWindowSize[1] << " ";
+    cameraArgs << "cameraClip " << clipping[0] << " " << clipping[1] << " ";
+    const double* openValues = xforms.front().getValues();
+    const double* closeValues = xforms.back().getValues();
+    cameraArgs << "cameraXformOpen";
+    for (size_t j = 0; j < 16; ++j)
+    {
+        cameraArgs << " " << openValues[j];
+    }
+    cameraArgs << " cameraXformClose";
     for (size_t j = 0; j < 16; ++j)
     {
-        ssXform << elems[j] << " ";
+        cameraArgs << " " << closeValues[j];
     }
-    _mantra.sendCommand(ssXform.str());
+    cameraArgs << " ";
+    _cameraArgs = cameraArgs.str();
+
+    const double* xformValues = xforms[0].getValues();
 
     // Create a dummy head-light
     _mantra.sendCommand("ray_start light");
@@ -350,19 +384,159 @@ bool MantraRendererPlugin::buildRenderCamera(
     return true;
 }
 
-void MantraRendererPlugin::buildMainProcedural()
+void MantraRendererPlugin::buildMainProcedural(
+    FnKat::Render::RenderSettings& settings)
 {
-    std::string procCommand = "ray_procedural KatanaProc ";
-    procCommand += "producerFilename \"";
-    procCommand += _scriptFilePath;
-    procCommand += "\" ";
+    std::ostringstream procCommand;
+    procCommand << "ray_procedural KatanaProc ";
+    procCommand << "producerFilename \"" << _scriptFilePath << "\" ";
+
+    // Motion blur settings, used to sample transforms and deformations
+    std::vector<float> motionSampleTimes;
+    getMotionSampleTimes(settings, motionSampleTimes);
+    procCommand << "shutterOpen " << settings.getShutterOpen() << " ";
+    procCommand << "shutterClose " << settings.getShutterClose() << " ";
+    procCommand << "motionSamples " << motionSampleTimes.size() << " ";
+
+    // Shared across renders, usually on a location visible from the farm
+    const char* geometryCacheDir = getenv("MFK_GEOMETRY_CACHE_DIR");
+    if (geometryCacheDir && geometryCacheDir[0])
+    {
+        procCommand << "geometryCacheDir \"" << geometryCacheDir << "\" ";
+    }
+
+    // Optionally, generated geometry follows the same memory limit as the
+    // Mantra cache
+    procCommand << "geometryBudget " << getGeometryBudget(getRootIterator())
+                << " ";
+
+    // Frustum culling, with a margin in world units for the objects seen
+    // through reflections or casting shadows in frame
+    procCommand << _cameraArgs;
+    float cullingMargin = 1.0f;
+    if (getFrustumCulling(getRootIterator(), cullingMargin))
+    {
+        procCommand << "frustumCulling 1 ";
+        procCommand << "cullingMargin " << cullingMargin << " ";
+    }
+
+    // Forced level of detail, otherwise selected from the screen size
+    FnKat::IntAttribute lodLevelAttr =
+        getRootIterator().getAttribute("mantra13GlobalStatements.lodlevel");
+    procCommand << "lodLevel " << lodLevelAttr.getValue(-1, false) << " ";
+
+    // Faces above which static meshes are built in chunks, on demand
+    FnKat::IntAttribute meshChunkFacesAttr = getRootIterator().getAttribute(
+        "mantra13GlobalStatements.meshchunkfaces");
+    procCommand << "meshChunkFaces " << meshChunkFacesAttr.getValue(0, false)
+                << " ";
+
+    // Translation statistics, written by the procedural at the end of the
+    // render next to the render logs of the Katana session
+    const char* translationStats = getenv("MFK_TRANSLATION_STATS");
+    if (translationStats && atoi(translationStats) != 0)
+    {
+        std::ostringstream statsFile;
+        statsFile << getKatanaTempDirectory() << "/mantra_katana_stats_"
+                  << getpid() << ".json";
+        procCommand << "statsFile \"" << statsFile.str() << "\" ";
+        std::cout << "Translation statistics: " << statsFile.str()
+                  << std::endl;
+    }
 
     _mantra.sendCommand("ray_start object");
-    _mantra.sendCommand(procCommand);
+    _mantra.sendCommand(procCommand.str());
     _mantra.sendCommand("ray_property object name \"katana_procedural\"");
     _mantra.sendCommand("ray_end");
 }
 
+float MantraRendererPlugin::getGeometryBudget(
+    FnKat::FnScenegraphIterator rootIterator) const
+{
+    // Defaults from MantraGlobalSettings.xml
+    int geometryBudget = 0;
+    int useCacheRatio = 1;
+    float cacheRatio = 0.25f;
+    float cacheSize = 1000.0f;
+
+    FnKat::GroupAttribute mantraGlobals =
+        rootIterator.getAttribute("mantra13GlobalStatements");
+    if (mantraGlobals.isValid())
+    {
+        FnKat::IntAttribute geometryBudgetAttr =
+            mantraGlobals.getChildByName("geometrybudget");
+        geometryBudget = geometryBudgetAttr.getValue(geometryBudget, false);
+
+        FnKat::IntAttribute useCacheRatioAttr =
+            mantraGlobals.getChildByName("usecacheratio");
+        FnKat::FloatAttribute cacheRatioAttr =
+            mantraGlobals.getChildByName("cacheratio");
+        FnKat::FloatAttribute cacheSizeAttr =
+            mantraGlobals.getChildByName("cachesize");
+        useCacheRatio = useCacheRatioAttr.getValue(useCacheRatio, false);
+        cacheRatio = cacheRatioAttr.getValue(cacheRatio, false);
+        cacheSize = cacheSizeAttr.getValue(cacheSize, false);
+    }
+
+    if (!geometryBudget)
+    {
+        return 0.0f;
+    }
+
+    if (!useCacheRatio)
+    {
+        return cacheSize;
+    }
+
+    // Proportion of the physical memory, in megabytes
+    const double physicalMemory =
+        static_cast<double>(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGE_SIZE);
+    return static_cast<float>(cacheRatio * physicalMemory / (1024 * 1024));
+}
+
+bool MantraRendererPlugin::getFrustumCulling(
+    FnKat::FnScenegraphIterator rootIterator, float& margin) const
+{
+    FnKat::GroupAttribute mantraGlobals =
+        rootIterator.getAttribute("mantra13GlobalStatements");
+    if (!mantraGlobals.isValid())
+    {
+        return false;
+    }
+
+    FnKat::IntAttribute frustumCullingAttr =
+        mantraGlobals.getChildByName("frustumculling");
+    FnKat::FloatAttribute cullingMarginAttr =
+        mantraGlobals.getChildByName("cullingmargin");
+    margin = cullingMarginAttr.getValue(margin, false);
+    return frustumCullingAttr.getValue(0, false) != 0;
+}
+
+void MantraRendererPlugin::getMotionSampleTimes(
+    FnKat::Render::RenderSettings& settings,
+    std::vector<float>& sampleTimes) const
+{
+    sampleTimes.clear();
+
+    const float shutterOpen = settings.getShutterOpen();
+    const float shutterClose = settings.getShutterClose();
+    const int maxTimeSamples = settings.getMaxTimeSamples();
+
+    // Without motion blur, the frame time
+    if (shutterClose <= shutterOpen || maxTimeSamples < 2)
+    {
+        sampleTimes.push_back(0.0f);
+        return;
+    }
+
+    // Samples are evenly spread over the shutter interval
+    for (int i = 0; i < maxTimeSamples; ++i)
+    {
+        sampleTimes.push_back(shutterOpen + (shutterClose - shutterOpen)
+                                  * i / (maxTimeSamples - 1));
+    }
+}
+
 template <typename T>
 std::string MantraRendererPlugin::buildPropertyString(T attr) const
 {